@@ -0,0 +1,274 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "checkpoint.hpp"
+#include "radix_sort.hpp"
+#include "tile_list.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+    constexpr char snapshot_magic[] = "P2TLSNP1";
+
+    constexpr size_t magic_size = sizeof(snapshot_magic) - 1;
+
+    /**
+     * Buffered writer of a file which is renamed to its final name when it is complete.
+     */
+    class SnapshotWriter {
+
+        static constexpr size_t buffer_size = 1 << 16;
+
+        std::string m_path;
+
+        std::string m_tmp_path;
+
+        FILE* m_file;
+
+        std::vector<unsigned char> m_buffer;
+
+        void flush() {
+            if (!m_buffer.empty() && fwrite(m_buffer.data(), 1, m_buffer.size(), m_file) != m_buffer.size()) {
+                throw std::runtime_error{"Failed to write " + m_tmp_path + ": " + strerror(errno)};
+            }
+            m_buffer.clear();
+        }
+
+    public:
+        explicit SnapshotWriter(const std::string& path) :
+            m_path(path),
+            m_tmp_path(path + ".tmp"),
+            m_file(fopen(m_tmp_path.c_str(), "wb")) {
+            if (!m_file) {
+                throw std::runtime_error{"Failed to open " + m_tmp_path + ": " + strerror(errno)};
+            }
+            m_buffer.reserve(buffer_size);
+        }
+
+        ~SnapshotWriter() {
+            if (m_file) {
+                fclose(m_file);
+            }
+        }
+
+        void write(const char* data, const size_t size) {
+            m_buffer.insert(m_buffer.end(), data, data + size);
+        }
+
+        void write_varint(uint64_t value) {
+            while (value >= 0x80) {
+                m_buffer.push_back(static_cast<unsigned char>(value | 0x80));
+                value >>= 7;
+            }
+            m_buffer.push_back(static_cast<unsigned char>(value));
+            if (m_buffer.size() >= buffer_size) {
+                flush();
+            }
+        }
+
+        /**
+         * Write the data to disk and move the file to its final name.
+         */
+        void commit() {
+            flush();
+            if (fflush(m_file) != 0 || fsync(fileno(m_file)) != 0) {
+                throw std::runtime_error{"Failed to write " + m_tmp_path + ": " + strerror(errno)};
+            }
+            fclose(m_file);
+            m_file = nullptr;
+            if (rename(m_tmp_path.c_str(), m_path.c_str()) != 0) {
+                throw std::runtime_error{"Failed to rename " + m_tmp_path + ": " + strerror(errno)};
+            }
+        }
+    };
+
+    /**
+     * Write sorted quadkeys as their count followed by the differences to their predecessors.
+     */
+    void write_quadkeys(SnapshotWriter& writer, const std::vector<uint64_t>& quadkeys) {
+        writer.write_varint(quadkeys.size());
+        uint64_t previous = 0;
+        for (const uint64_t quadkey : quadkeys) {
+            writer.write_varint(quadkey - previous);
+            previous = quadkey;
+        }
+    }
+
+    uint64_t read_varint(const std::vector<unsigned char>& data, size_t& pos) {
+        uint64_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (pos >= data.size()) {
+                throw std::runtime_error{"Truncated checkpoint snapshot"};
+            }
+            const unsigned char byte = data[pos++];
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        throw std::runtime_error{"Invalid checkpoint snapshot"};
+    }
+
+    std::vector<uint64_t> read_quadkeys(const std::vector<unsigned char>& data, size_t& pos) {
+        const uint64_t count = read_varint(data, pos);
+        // every quadkey needs at least one byte
+        if (count > data.size() - pos) {
+            throw std::runtime_error{"Truncated checkpoint snapshot"};
+        }
+        std::vector<uint64_t> quadkeys;
+        quadkeys.reserve(count);
+        uint64_t quadkey = 0;
+        for (uint64_t i = 0; i < count; ++i) {
+            quadkey += read_varint(data, pos);
+            quadkeys.push_back(quadkey);
+        }
+        return quadkeys;
+    }
+
+} // anonymous namespace
+
+Checkpoint::Checkpoint(const std::string& directory, const std::string& job, const std::chrono::seconds interval) :
+    m_directory(directory),
+    m_job(job),
+    m_interval(interval),
+    m_last_save(std::chrono::steady_clock::now()) {
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error{"Failed to create checkpoint directory " + directory + ": " + strerror(errno)};
+    }
+}
+
+std::string Checkpoint::path(const std::string& name) const {
+    return m_directory + "/" + name;
+}
+
+std::string Checkpoint::snapshot_path(const uint64_t number) const {
+    return path("tiles-" + std::to_string(number) + ".bin");
+}
+
+void Checkpoint::write_snapshot(const uint64_t number) {
+    radix_sort_unique(m_tiles, 64);
+    radix_sort_unique(m_full_tiles, 64);
+    SnapshotWriter writer {snapshot_path(number)};
+    writer.write(snapshot_magic, magic_size);
+    write_quadkeys(writer, m_tiles);
+    write_quadkeys(writer, m_full_tiles);
+    writer.commit();
+}
+
+void Checkpoint::read_snapshot(const uint64_t number, TileList& tile_list) {
+    const std::string snapshot = snapshot_path(number);
+    std::ifstream in {snapshot, std::ios::binary};
+    if (!in) {
+        throw std::runtime_error{"Failed to open checkpoint snapshot " + snapshot};
+    }
+    std::vector<unsigned char> data {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    if (data.size() < magic_size || memcmp(data.data(), snapshot_magic, magic_size) != 0) {
+        throw std::runtime_error{snapshot + " is not a checkpoint snapshot"};
+    }
+    size_t pos = magic_size;
+    tile_list.add_quadkeys(read_quadkeys(data, pos), false);
+    tile_list.add_quadkeys(read_quadkeys(data, pos), true);
+}
+
+void Checkpoint::write_state() {
+    const std::string state_path = path("state");
+    const std::string tmp_path = state_path + ".tmp";
+    FILE* file = fopen(tmp_path.c_str(), "w");
+    if (!file) {
+        throw std::runtime_error{"Failed to open " + tmp_path + ": " + strerror(errno)};
+    }
+    fprintf(file, "job=%s\nlayer=%zu\nposition=%lu\nfirst_snapshot=%lu\nlast_snapshot=%lu\n", m_job.c_str(),
+            m_layer, m_position, m_first_snapshot, m_last_snapshot);
+    const bool ok = fflush(file) == 0 && fsync(fileno(file)) == 0;
+    fclose(file);
+    if (!ok || rename(tmp_path.c_str(), state_path.c_str()) != 0) {
+        throw std::runtime_error{"Failed to write " + state_path + ": " + strerror(errno)};
+    }
+}
+
+bool Checkpoint::load(TileList& tile_list) {
+    const std::string state_path = path("state");
+    std::ifstream in {state_path};
+    if (!in) {
+        return false;
+    }
+    std::string job;
+    std::string line;
+    while (std::getline(in, line)) {
+        const size_t separator = line.find('=');
+        if (separator == std::string::npos) {
+            throw std::runtime_error{"Invalid line in " + state_path + ": " + line};
+        }
+        const std::string key = line.substr(0, separator);
+        const std::string value = line.substr(separator + 1);
+        try {
+            if (key == "job") {
+                job = value;
+            } else if (key == "layer") {
+                m_layer = std::stoull(value);
+            } else if (key == "position") {
+                m_position = std::stoull(value);
+            } else if (key == "first_snapshot") {
+                m_first_snapshot = std::stoull(value);
+            } else if (key == "last_snapshot") {
+                m_last_snapshot = std::stoull(value);
+            }
+        } catch (const std::logic_error&) {
+            throw std::runtime_error{"Invalid line in " + state_path + ": " + line};
+        }
+    }
+    if (job != m_job) {
+        throw std::runtime_error{"Checkpoint in " + m_directory + " belongs to another job (" + job + ")"};
+    }
+    for (uint64_t number = m_first_snapshot; number <= m_last_snapshot; ++number) {
+        read_snapshot(number, tile_list);
+    }
+    m_last_save = std::chrono::steady_clock::now();
+    return true;
+}
+
+void Checkpoint::save(TileList& tile_list, const size_t layer, const uint64_t position) {
+    tile_list.take_added_tiles(m_tiles, m_full_tiles);
+    const uint64_t old_first = m_first_snapshot;
+    const uint64_t old_last = m_last_snapshot;
+    // Replace all snapshots by a single one if there are too many of them.
+    const bool compact = m_last_snapshot + 1 - m_first_snapshot >= max_snapshots;
+    if (compact) {
+        m_tiles = tile_list.single_quadkeys(false);
+        m_full_tiles = tile_list.single_quadkeys(true);
+    }
+    if (compact || !m_tiles.empty() || !m_full_tiles.empty()) {
+        write_snapshot(++m_last_snapshot);
+        if (compact) {
+            m_first_snapshot = m_last_snapshot;
+        }
+    }
+    m_layer = layer;
+    m_position = position;
+    write_state();
+    if (compact) {
+        for (uint64_t number = old_first; number <= old_last; ++number) {
+            unlink(snapshot_path(number).c_str());
+        }
+    }
+    m_last_save = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SRC_CHECKPOINT_HPP_
+#define SRC_CHECKPOINT_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class TileList;
+
+/**
+ * Persistent state of a long-running job in a directory, used to resume it after a crash.
+ *
+ * The state consists of the position of the next feature to be read (layer index and number
+ * of features of that layer read before) and the single tiles found so far. The tiles are
+ * saved incrementally: every checkpoint writes a snapshot file with the tiles added since the
+ * previous one. The quadkeys of a snapshot are sorted and stored as variable-length encoded
+ * differences. After max_snapshots snapshots, all tiles are written into a single snapshot
+ * and the older ones are removed.
+ *
+ * The file `state` lists the valid snapshots. It is replaced atomically after the snapshot
+ * has been written, therefore a crash while writing a checkpoint leaves the previous one intact.
+ */
+class Checkpoint {
+
+    std::string m_directory;
+
+    /// description of the job, the state of another job is not resumed
+    std::string m_job;
+
+    std::chrono::steady_clock::duration m_interval;
+
+    std::chrono::steady_clock::time_point m_last_save;
+
+    /// number of the first and last valid snapshot, no snapshot exists if m_last_snapshot is 0
+    uint64_t m_first_snapshot = 1;
+    uint64_t m_last_snapshot = 0;
+
+    size_t m_layer = 0;
+
+    uint64_t m_position = 0;
+
+    /// buffers reused for the tiles of each snapshot
+    std::vector<uint64_t> m_tiles;
+    std::vector<uint64_t> m_full_tiles;
+
+    static constexpr uint64_t max_snapshots = 16;
+
+    std::string path(const std::string& name) const;
+
+    std::string snapshot_path(const uint64_t number) const;
+
+    void write_snapshot(const uint64_t number);
+
+    void read_snapshot(const uint64_t number, TileList& tile_list);
+
+    void write_state();
+
+public:
+    /**
+     * \param directory directory of the checkpoint files, it is created if it does not exist
+     * \param job description of the job (input and all options affecting the tiles found)
+     * \param interval minimum time between two checkpoints
+     *
+     * \throws std::runtime_error if the directory cannot be created
+     */
+    Checkpoint(const std::string& directory, const std::string& job, const std::chrono::seconds interval);
+
+    /**
+     * Load the state of a previous run of the job and add its tiles to a tile list.
+     *
+     * \returns false if there is no state to resume from
+     *
+     * \throws std::runtime_error if the state belongs to another job or cannot be read
+     */
+    bool load(TileList& tile_list);
+
+    /**
+     * Index of the layer to continue with
+     */
+    size_t layer() const noexcept {
+        return m_layer;
+    }
+
+    /**
+     * Number of features of layer() which have been processed already
+     */
+    uint64_t position() const noexcept {
+        return m_position;
+    }
+
+    /**
+     * Check if the interval since the last checkpoint has passed.
+     */
+    bool due() const noexcept {
+        return std::chrono::steady_clock::now() - m_last_save >= m_interval;
+    }
+
+    /**
+     * Save the tiles added to a tile list since the last checkpoint (see TileList::track_added_tiles())
+     * and the position of the next feature.
+     *
+     * \param tile_list tile list, all tiles added before the feature at the position have to be in it
+     * \param layer index of the layer of the next feature
+     * \param position number of features of the layer processed already
+     *
+     * \throws std::runtime_error if writing fails
+     */
+    void save(TileList& tile_list, const size_t layer, const uint64_t position);
+};
+
+#endif /* SRC_CHECKPOINT_HPP_ */
@@ -0,0 +1,513 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "flatgeobuf_reader.hpp"
+#include "projection.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+    constexpr unsigned char magic[] = {'f', 'g', 'b', 3, 'f', 'g', 'b'};
+
+    /// size of the magic bytes including the patch version
+    constexpr size_t magic_size = 8;
+
+    /// size of a node of the spatial index (four doubles and an unsigned 64 bit offset)
+    constexpr size_t node_item_size = 40;
+
+    namespace header_field {
+        constexpr unsigned name = 0;
+        constexpr unsigned geometry_type = 2;
+        constexpr unsigned features_count = 8;
+        constexpr unsigned index_node_size = 9;
+        constexpr unsigned crs = 10;
+    }
+
+    namespace crs_field {
+        constexpr unsigned org = 0;
+        constexpr unsigned code = 1;
+    }
+
+    namespace feature_field {
+        constexpr unsigned geometry = 0;
+    }
+
+    namespace geometry_field {
+        constexpr unsigned ends = 0;
+        constexpr unsigned xy = 1;
+        constexpr unsigned type = 6;
+        constexpr unsigned parts = 7;
+    }
+
+    enum geometry_type : uint8_t {
+        unknown = 0,
+        point = 1,
+        linestring = 2,
+        polygon = 3,
+        multipoint = 4,
+        multilinestring = 5,
+        multipolygon = 6
+    };
+
+    /**
+     * Access to the tables of a FlatBuffers buffer. All positions are relative to the start of
+     * the buffer and all reads are checked against its size.
+     */
+    class Buffer {
+
+        const unsigned char* m_data;
+
+        size_t m_size;
+
+    public:
+        Buffer(const unsigned char* data, const size_t size) :
+            m_data(data),
+            m_size(size) {
+        }
+
+        template <typename T>
+        T read(const size_t pos) const {
+            if (pos > m_size || m_size - pos < sizeof(T)) {
+                throw std::runtime_error{"FlatGeobuf buffer too short"};
+            }
+            // The data is not necessarily aligned.
+            T value;
+            memcpy(&value, m_data + pos, sizeof(T));
+            return value;
+        }
+
+        /**
+         * Follow an unsigned offset stored at a position.
+         */
+        size_t follow(const size_t pos) const {
+            return pos + read<uint32_t>(pos);
+        }
+
+        /**
+         * Get the position of a field of a table.
+         *
+         * \returns position of the field or 0 if the field is not present
+         */
+        size_t field(const size_t table, const unsigned index) const {
+            const int64_t vtable = static_cast<int64_t>(table) - read<int32_t>(table);
+            if (vtable < 0) {
+                throw std::runtime_error{"Invalid FlatGeobuf table"};
+            }
+            const size_t entry = 4 + 2 * index;
+            if (entry + 2 > read<uint16_t>(vtable)) {
+                return 0;
+            }
+            const uint16_t offset = read<uint16_t>(vtable + entry);
+            return offset ? table + offset : 0;
+        }
+
+        template <typename T>
+        T scalar(const size_t table, const unsigned index, const T default_value) const {
+            const size_t pos = field(table, index);
+            return pos ? read<T>(pos) : default_value;
+        }
+
+        /**
+         * Get the position of a table, vector or string referenced by a field.
+         *
+         * \returns position or 0 if the field is not present
+         */
+        size_t reference(const size_t table, const unsigned index) const {
+            const size_t pos = field(table, index);
+            return pos ? follow(pos) : 0;
+        }
+
+        /**
+         * Get the position of the first element of a vector referenced by a field.
+         *
+         * \param count set to the number of elements, 0 if the field is not present
+         */
+        size_t vector(const size_t table, const unsigned index, const size_t element_size, uint32_t& count) const {
+            count = 0;
+            const size_t pos = reference(table, index);
+            if (!pos) {
+                return 0;
+            }
+            count = read<uint32_t>(pos);
+            if ((m_size - pos - 4) / element_size < count) {
+                throw std::runtime_error{"FlatGeobuf vector exceeds buffer"};
+            }
+            return pos + 4;
+        }
+
+        std::string string(const size_t table, const unsigned index) const {
+            uint32_t length;
+            const size_t pos = vector(table, index, 1, length);
+            return pos ? std::string(reinterpret_cast<const char*>(m_data + pos), length) : std::string();
+        }
+    };
+
+    /**
+     * Read the coordinates of a Geometry table into Boost Geometry.
+     */
+    class GeometryDecoder {
+
+        const Buffer& m_buffer;
+
+        bool m_project;
+
+        size_t m_xy;
+
+        uint32_t m_point_count;
+
+        size_t m_ends;
+
+        uint32_t m_end_count;
+
+        bpoint_t point(const uint32_t i) const {
+            const double x = m_buffer.read<double>(m_xy + 16 * static_cast<size_t>(i));
+            const double y = m_buffer.read<double>(m_xy + 16 * static_cast<size_t>(i) + 8);
+            if (m_project) {
+                return bpoint_t(projection::lon_to_x(x), projection::lat_to_y(y));
+            }
+            return bpoint_t(x, y);
+        }
+
+        /**
+         * Append the points [begin, end) to a ring or linestring.
+         */
+        template <typename TRange>
+        void append(TRange& range, const uint32_t begin, const uint32_t end) const {
+            range.reserve(end - begin);
+            for (uint32_t i = begin; i < end; ++i) {
+                range.push_back(point(i));
+            }
+        }
+
+        /**
+         * Get the end of the i-th part (ring or linestring). A geometry without ends has a
+         * single part.
+         */
+        uint32_t part_end(const uint32_t i) const {
+            if (m_end_count == 0) {
+                return m_point_count;
+            }
+            const uint32_t end = m_buffer.read<uint32_t>(m_ends + 4 * static_cast<size_t>(i));
+            if (end > m_point_count) {
+                throw std::runtime_error{"Invalid ends of FlatGeobuf geometry"};
+            }
+            return end;
+        }
+
+        uint32_t part_count() const {
+            return std::max<uint32_t>(m_end_count, 1);
+        }
+
+    public:
+        GeometryDecoder(const Buffer& buffer, const size_t table, const bool project) :
+            m_buffer(buffer),
+            m_project(project) {
+            uint32_t coordinates;
+            m_xy = m_buffer.vector(table, geometry_field::xy, 8, coordinates);
+            m_point_count = coordinates / 2;
+            m_ends = m_buffer.vector(table, geometry_field::ends, 4, m_end_count);
+        }
+
+        bool empty() const noexcept {
+            return m_point_count == 0;
+        }
+
+        bpoint_t read_point() const {
+            return point(0);
+        }
+
+        bmulti_point_t read_multi_point() const {
+            bmulti_point_t mp;
+            append(mp, 0, m_point_count);
+            return mp;
+        }
+
+        blinestring_t read_linestring() const {
+            blinestring_t ls;
+            append(ls, 0, m_point_count);
+            return ls;
+        }
+
+        bmulti_linestring_t read_multi_linestring() const {
+            bmulti_linestring_t mls;
+            mls.resize(part_count());
+            uint32_t begin = 0;
+            for (uint32_t i = 0; i < mls.size(); ++i) {
+                const uint32_t end = std::max(part_end(i), begin);
+                append(mls[i], begin, end);
+                begin = end;
+            }
+            return mls;
+        }
+
+        /**
+         * Read a polygon, the first ring is the outer ring.
+         */
+        void read_polygon(bpolygon_t& polygon) const {
+            const uint32_t rings = part_count();
+            polygon.inners().resize(rings - 1);
+            uint32_t begin = 0;
+            for (uint32_t i = 0; i < rings; ++i) {
+                const uint32_t end = std::max(part_end(i), begin);
+                if (i == 0) {
+                    append(polygon.outer(), begin, end);
+                } else {
+                    append(polygon.inners()[i - 1], begin, end);
+                }
+                begin = end;
+            }
+        }
+    };
+
+    bool read_geometry(const Buffer& buffer, const size_t table, const uint8_t type, const bool project,
+            bgeometry_t& geometry) {
+        if (type == geometry_type::multipolygon) {
+            uint32_t part_count;
+            const size_t parts = buffer.vector(table, geometry_field::parts, 4, part_count);
+            bmulti_polygon_t mp;
+            if (part_count == 0) {
+                // a multipolygon with a single part can be encoded like a polygon
+                GeometryDecoder decoder {buffer, table, project};
+                if (decoder.empty()) {
+                    return false;
+                }
+                mp.resize(1);
+                decoder.read_polygon(mp.back());
+                geometry = std::move(mp);
+                return true;
+            }
+            mp.reserve(part_count);
+            for (uint32_t i = 0; i < part_count; ++i) {
+                GeometryDecoder decoder {buffer, buffer.follow(parts + 4 * static_cast<size_t>(i)), project};
+                if (decoder.empty()) {
+                    continue;
+                }
+                mp.resize(mp.size() + 1);
+                decoder.read_polygon(mp.back());
+            }
+            if (mp.empty()) {
+                return false;
+            }
+            geometry = std::move(mp);
+            return true;
+        }
+        GeometryDecoder decoder {buffer, table, project};
+        if (decoder.empty()) {
+            return false;
+        }
+        switch (type) {
+        case geometry_type::point:
+            geometry = decoder.read_point();
+            break;
+        case geometry_type::multipoint:
+            geometry = decoder.read_multi_point();
+            break;
+        case geometry_type::linestring:
+            geometry = decoder.read_linestring();
+            break;
+        case geometry_type::multilinestring:
+            geometry = decoder.read_multi_linestring();
+            break;
+        case geometry_type::polygon: {
+            bpolygon_t polygon;
+            decoder.read_polygon(polygon);
+            geometry = std::move(polygon);
+            break;
+        }
+        default:
+            throw std::runtime_error{"Unsupported FlatGeobuf geometry type " + std::to_string(static_cast<unsigned>(type))};
+        }
+        return true;
+    }
+
+} // anonymous namespace
+
+FlatGeobufReader::FlatGeobufReader(const std::string& path) :
+    m_path(path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw std::runtime_error{"Failed to open " + path + ": " + strerror(errno)};
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error{"Failed to get size of " + path + ": " + strerror(errno)};
+    }
+    m_size = static_cast<size_t>(st.st_size);
+    if (m_size < magic_size + 4) {
+        close(fd);
+        throw std::runtime_error{path + " is not a FlatGeobuf file"};
+    }
+    void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error{"Failed to map " + path + ": " + strerror(errno)};
+    }
+    m_data = static_cast<const unsigned char*>(data);
+    try {
+        parse_header();
+        init_index();
+    } catch (...) {
+        munmap(data, m_size);
+        throw;
+    }
+    // Features are read in the order of the file, also if they are selected using the index.
+    posix_madvise(data, m_size, POSIX_MADV_SEQUENTIAL);
+}
+
+FlatGeobufReader::~FlatGeobufReader() {
+    munmap(const_cast<unsigned char*>(m_data), m_size);
+}
+
+/*static*/ bool FlatGeobufReader::is_flatgeobuf(const std::string& path) {
+    const std::string suffix = ".fgb";
+    return path.size() > suffix.size() && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+void FlatGeobufReader::parse_header() {
+    if (memcmp(m_data, magic, sizeof(magic)) != 0) {
+        throw std::runtime_error{m_path + " is not a FlatGeobuf file (version 3)"};
+    }
+    Buffer file {m_data, m_size};
+    const size_t header_size = file.read<uint32_t>(magic_size);
+    if (header_size > m_size - magic_size - 4) {
+        throw std::runtime_error{"Header of " + m_path + " exceeds the file"};
+    }
+    Buffer header {m_data + magic_size + 4, header_size};
+    const size_t root = header.follow(0);
+    m_name = header.string(root, header_field::name);
+    m_geometry_type = header.scalar<uint8_t>(root, header_field::geometry_type, geometry_type::unknown);
+    m_feature_count = header.scalar<uint64_t>(root, header_field::features_count, 0);
+    m_index_node_size = header.scalar<uint16_t>(root, header_field::index_node_size, 16);
+    const size_t crs = header.reference(root, header_field::crs);
+    m_crs_code = 0;
+    if (crs) {
+        // The code is an EPSG code unless another organization is given (case-insensitive).
+        std::string org = header.string(crs, crs_field::org);
+        std::transform(org.begin(), org.end(), org.begin(), [](const unsigned char c) {
+            return static_cast<char>(std::tolower(c));
+        });
+        if (org.empty() || org == "epsg") {
+            m_crs_code = header.scalar<int32_t>(crs, crs_field::code, 0);
+        }
+    }
+    m_index = magic_size + 4 + header_size;
+    m_features = m_index;
+}
+
+void FlatGeobufReader::init_index() {
+    if (m_index_node_size == 0 || m_feature_count == 0) {
+        return;
+    }
+    if (m_index_node_size < 2) {
+        throw std::runtime_error{"Invalid node size of the index of " + m_path};
+    }
+    // number of nodes of each level, bottom-up
+    std::vector<uint64_t> level_nodes;
+    uint64_t n = m_feature_count;
+    m_node_count = n;
+    level_nodes.push_back(n);
+    do {
+        n = (n + m_index_node_size - 1) / m_index_node_size;
+        m_node_count += n;
+        level_nodes.push_back(n);
+    } while (n != 1);
+    // The root is stored first, the leaves last.
+    n = m_node_count;
+    for (const uint64_t count : level_nodes) {
+        n -= count;
+        m_level_bounds.emplace_back(n, n + count);
+    }
+    if (m_node_count > (m_size - m_index) / node_item_size) {
+        throw std::runtime_error{"Index of " + m_path + " exceeds the file"};
+    }
+    m_features = m_index + m_node_count * node_item_size;
+}
+
+FlatGeobufReader::Item FlatGeobufReader::node(const uint64_t index) const {
+    Item item;
+    const unsigned char* pos = m_data + m_index + index * node_item_size;
+    memcpy(&item.min_x, pos, 8);
+    memcpy(&item.min_y, pos + 8, 8);
+    memcpy(&item.max_x, pos + 16, 8);
+    memcpy(&item.max_y, pos + 24, 8);
+    memcpy(&item.offset, pos + 32, 8);
+    return item;
+}
+
+std::vector<FlatGeobufReader::Item> FlatGeobufReader::search(const Item& box) const {
+    std::vector<Item> results;
+    const uint64_t leaves_begin = m_node_count - m_feature_count;
+    // pairs of the first node of a group of siblings and their level
+    std::vector<std::pair<uint64_t, size_t>> queue;
+    queue.emplace_back(0, m_level_bounds.size() - 1);
+    while (!queue.empty()) {
+        const uint64_t first = queue.back().first;
+        const size_t level = queue.back().second;
+        queue.pop_back();
+        const bool leaves = first >= leaves_begin;
+        const uint64_t end = std::min<uint64_t>(first + m_index_node_size, m_level_bounds[level].second);
+        for (uint64_t pos = first; pos < end; ++pos) {
+            const Item n = node(pos);
+            if (!n.intersects(box)) {
+                continue;
+            }
+            if (leaves) {
+                results.push_back(n);
+            } else if (level > 0 && n.offset < m_node_count) {
+                // The offset of an inner node is the index of its first child.
+                queue.emplace_back(n.offset, level - 1);
+            }
+        }
+    }
+    std::sort(results.begin(), results.end(), [](const Item& a, const Item& b) {
+        return a.offset < b.offset;
+    });
+    return results;
+}
+
+uint64_t FlatGeobufReader::next_feature(const uint64_t offset) const {
+    Buffer features {m_data + m_features, m_size - m_features};
+    const uint32_t size = features.read<uint32_t>(offset);
+    if (size > features_size() - offset - 4) {
+        throw std::runtime_error{"Feature at offset " + std::to_string(offset) + " of " + m_path + " exceeds the file"};
+    }
+    return offset + 4 + size;
+}
+
+bool FlatGeobufReader::read_feature(const uint64_t offset, const bool project, bgeometry_t& geometry,
+        uint64_t& next) const {
+    next = next_feature(offset);
+    const uint32_t size = static_cast<uint32_t>(next - offset - 4);
+    Buffer feature {m_data + m_features + offset + 4, size};
+    const size_t root = feature.follow(0);
+    const size_t table = feature.reference(root, feature_field::geometry);
+    if (!table) {
+        return false;
+    }
+    uint8_t type = feature.scalar<uint8_t>(table, geometry_field::type, geometry_type::unknown);
+    if (type == geometry_type::unknown) {
+        type = m_geometry_type;
+    }
+    return read_geometry(feature, table, type, project, geometry);
+}
@@ -0,0 +1,173 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SRC_FLATGEOBUF_READER_HPP_
+#define SRC_FLATGEOBUF_READER_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "geometry_types.hpp"
+
+/**
+ * Reader of FlatGeobuf files which does not depend on GDAL.
+ *
+ * The file is mapped into memory. The FlatBuffers tables of the header and the features
+ * are accessed in place and the coordinates of a feature are copied directly from the
+ * mapped file into a Boost Geometry. The packed Hilbert R-tree of the file (if present)
+ * is used to read only the features intersecting a bounding box.
+ *
+ * Properties of the features are not read.
+ */
+class FlatGeobufReader {
+
+public:
+    /**
+     * Bounding box and offset of a feature as stored in the leaves of the spatial index.
+     * The coordinates are in the coordinate reference system of the file.
+     */
+    struct Item {
+        double min_x;
+        double min_y;
+        double max_x;
+        double max_y;
+        /// byte offset of the feature relative to the start of the feature section
+        uint64_t offset;
+
+        bool intersects(const Item& other) const noexcept {
+            return max_x >= other.min_x && max_y >= other.min_y && min_x <= other.max_x && min_y <= other.max_y;
+        }
+    };
+
+private:
+    std::string m_path;
+
+    const unsigned char* m_data = nullptr;
+
+    size_t m_size = 0;
+
+    std::string m_name;
+
+    uint8_t m_geometry_type;
+
+    int32_t m_crs_code;
+
+    uint64_t m_feature_count;
+
+    uint16_t m_index_node_size;
+
+    /// start of the spatial index, equal to m_features if there is no index
+    size_t m_index;
+
+    /// start of the feature section
+    size_t m_features;
+
+    /// first and last + 1 node of each level of the index, leaves first
+    std::vector<std::pair<uint64_t, uint64_t>> m_level_bounds;
+
+    uint64_t m_node_count = 0;
+
+    void parse_header();
+
+    void init_index();
+
+    Item node(const uint64_t index) const;
+
+public:
+    /**
+     * Open and map a FlatGeobuf file.
+     *
+     * \throws std::runtime_error if the file cannot be read or is not a valid FlatGeobuf file
+     */
+    explicit FlatGeobufReader(const std::string& path);
+
+    FlatGeobufReader(const FlatGeobufReader&) = delete;
+
+    FlatGeobufReader& operator=(const FlatGeobufReader&) = delete;
+
+    ~FlatGeobufReader();
+
+    /**
+     * Check if a file is a FlatGeobuf file by its suffix.
+     */
+    static bool is_flatgeobuf(const std::string& path);
+
+    const std::string& name() const noexcept {
+        return m_name;
+    }
+
+    /**
+     * EPSG code of the coordinate reference system, 0 if the file does not specify one or
+     * specifies it only as WKT or by the code of another organization.
+     */
+    int32_t crs_code() const noexcept {
+        return m_crs_code;
+    }
+
+    uint64_t feature_count() const noexcept {
+        return m_feature_count;
+    }
+
+    bool has_index() const noexcept {
+        return !m_level_bounds.empty();
+    }
+
+    /**
+     * Size of the feature section in bytes
+     */
+    uint64_t features_size() const noexcept {
+        return m_size - m_features;
+    }
+
+    /**
+     * Get the bounding box and offset of the i-th feature from the spatial index. The file must
+     * have an index.
+     */
+    Item item(const uint64_t i) const {
+        return node(m_node_count - m_feature_count + i);
+    }
+
+    /**
+     * Search the spatial index for features whose bounding box intersects a box in the
+     * coordinate reference system of the file. The file must have an index.
+     *
+     * \returns matching items sorted by their offset
+     */
+    std::vector<Item> search(const Item& box) const;
+
+    /**
+     * Read the geometry of the feature at an offset. Geometries with a geographic coordinate
+     * reference system are projected to Web Mercator if requested.
+     *
+     * \param offset byte offset of the feature relative to the start of the feature section
+     * \param project project the coordinates from WGS84 to Web Mercator
+     * \param geometry geometry to be filled
+     * \param next set to the offset of the next feature
+     *
+     * \returns false if the feature has no geometry or an empty one
+     *
+     * \throws std::runtime_error if the feature is invalid or of an unsupported geometry type
+     */
+    bool read_feature(const uint64_t offset, const bool project, bgeometry_t& geometry, uint64_t& next) const;
+
+    /**
+     * Get the offset of the feature following the feature at an offset without reading it.
+     *
+     * \throws std::runtime_error if the feature exceeds the file
+     */
+    uint64_t next_feature(const uint64_t offset) const;
+};
+
+#endif /* SRC_FLATGEOBUF_READER_HPP_ */
@@ -14,83 +14,652 @@
  */
 
 #include "gdal_intersecting_tiles_finder.hpp"
+#include "checkpoint.hpp"
+#include "flatgeobuf_reader.hpp"
+#include "geometry_cache.hpp"
 #include "projection.hpp"
+#include "parallel.hpp"
+#include "segment_index.hpp"
+#include "tile_estimate.hpp"
+#include "tile_space_index.hpp"
 #include "utils.hpp"
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <type_traits>
 #include <boost/geometry.hpp>
 
 
 GDALIntersectingTilesFinder::GDALIntersectingTilesFinder(const bool verbose, uint32_t minzoom,
-        uint32_t maxzoom, bool check_tiles, bool tirex) :
+        uint32_t maxzoom, bool check_tiles, bool tirex, bool classify, Stats& stats) :
     m_features(0),
+    m_layer_feature_count(-1),
+    m_layer_start(),
     m_minzoom(minzoom),
+    m_web_merc_ref(),
+    m_wgs84_ref(),
+    m_wgs84_transformation(),
     m_verbose(verbose),
+    m_classify(classify),
+    m_index_threshold(1000),
+    m_threads(1),
+    m_fixed_point(false),
+    m_filter_enabled(false),
+    m_filter_bbox(),
+    m_checkpoint(nullptr),
+    m_layer_index(0),
+    m_geometry_cache_directory(),
+    m_cache_writer(nullptr),
+    m_max_tiles_per_feature(0),
+    m_sort_features(false),
     m_maxzoom(maxzoom),
-    m_tile_list(maxzoom, check_tiles, tirex),
-    m_web_merc_ref() {
+    m_stats(stats),
+    m_tile_list(maxzoom, check_tiles, tirex, classify, stats) {
     m_web_merc_ref.importFromProj4("+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0 +k=1.0 +units=m +nadgrids=@null +wktext  +no_defs");
+    m_wgs84_ref.importFromEPSG(4326);
+#if GDAL_VERSION_MAJOR >= 3
+    m_wgs84_ref.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+#endif
     OGRRegisterAll();
 }
 
-void GDALIntersectingTilesFinder::handle_boost_geometry(bgeometry_t geometry, const double buffer_size) {
-    box_t box = get_envelope_from_geom(geometry);
-    // 2) get buffer size at that latitude
-    bool buffering_required = (buffer_size > 0);
-    bgeometry_t buffered = geometry;
-    if (buffering_required) {
-        double avg_lat = (box.max_corner().get<1>() - box.min_corner().get<1>()) / 2 + box.min_corner().get<1>();
-        double scale = projection::mercator_scale(projection::y_to_lat(avg_lat));
-        double buffer = buffer_size * scale;
+void GDALIntersectingTilesFinder::add_geometry(bgeometry_t geometry, const double buffer_size) {
+    handle_boost_geometry(std::move(geometry), buffer_size);
+}
+
+void GDALIntersectingTilesFinder::add_wkb(const unsigned char* wkb, const size_t size, const double buffer_size) {
+    OGRGeometry* geometry = nullptr;
+    if (OGRGeometryFactory::createFromWkb(wkb, nullptr, &geometry, size) != OGRERR_NONE || !geometry) {
+        throw std::runtime_error{"Failed to parse WKB geometry"};
+    }
+    std::unique_ptr<OGRGeometry, decltype(&OGRGeometryFactory::destroyGeometry)> geometry_ptr {geometry,
+        &OGRGeometryFactory::destroyGeometry};
+    if (!m_wgs84_transformation) {
+        m_wgs84_transformation.reset(OGRCreateCoordinateTransformation(&m_wgs84_ref, &m_web_merc_ref));
+    }
+    if (geometry->transform(m_wgs84_transformation.get()) != OGRERR_NONE) {
+        throw std::runtime_error{"Failed to transform WKB geometry"};
+    }
+    if (tiles_already_covered(geometry, buffer_size)) {
+        return;
+    }
+    handle_boost_geometry(ogr2boost_geom(geometry), buffer_size);
+}
+
+blinestring_t GDALIntersectingTilesFinder::lonlat_to_linestring(const double* coords, const size_t point_count) {
+    blinestring_t ls;
+    ls.reserve(point_count);
+    for (size_t i = 0; i < point_count; ++i) {
+        bgeom::append(ls, bpoint_t(projection::lon_to_x(coords[2 * i]), projection::lat_to_y(coords[2 * i + 1])));
+    }
+    return ls;
+}
+
+void GDALIntersectingTilesFinder::add_lonlat_linestring(const double* coords, const size_t point_count,
+        const double buffer_size) {
+    handle_boost_geometry(lonlat_to_linestring(coords, point_count), buffer_size);
+}
+
+void GDALIntersectingTilesFinder::add_lonlat_polygon(const double* coords, const size_t point_count,
+        const double buffer_size) {
+    bpolygon_t polygon;
+    blinestring_t ring = lonlat_to_linestring(coords, point_count);
+    polygon.outer().assign(ring.begin(), ring.end());
+    bgeom::correct(polygon);
+    handle_boost_geometry(std::move(polygon), buffer_size);
+}
+
+void GDALIntersectingTilesFinder::prepare_geometry(bgeometry_t& geometry, const double buffer_size) {
+    // 1) A geometry crossing the antimeridian spans the whole map. It is made continuous by moving its
+    // western part east of the antimeridian; for_each_side() wraps it around again.
+    if (crosses_antimeridian(geometry)) {
+        StageTimer timer {m_stats, Stage::envelope};
+        bgeometry_t shifted = geometry;
+        shift_x(shifted, projection::earth_circumfence, 0);
+        const box_t box = get_envelope_from_geom(geometry);
+        const box_t shifted_box = get_envelope_from_geom(shifted);
+        // Geometries around a pole (e.g. Antarctica) do not get narrower.
+        if (shifted_box.max_corner().get<0>() - shifted_box.min_corner().get<0>()
+                < box.max_corner().get<0>() - box.min_corner().get<0>()) {
+            // The orientation of rings whose winding was corrected for the wide geometry is reversed.
+            std::visit([](auto& g) { bgeom::correct(g); }, shifted);
+            geometry = std::move(shifted);
+        }
+    }
+    if (buffer_size > 0) {
+        box_t box;
+        {
+            StageTimer timer {m_stats, Stage::envelope};
+            box = get_envelope_from_geom(geometry);
+        }
+        // 2) get buffer size at that latitude
+        StageTimer timer {m_stats, Stage::buffer};
+        double buffer = buffer_in_merc(buffer_size, box.min_corner().get<1>(), box.max_corner().get<1>());
         // 3) buffer
-        buffered = std::move(get_buffer_from_geom(geometry, buffer));
-        // 4) get bounding box of buffer
-        box = get_envelope_from_geom(buffered);
+        geometry = get_buffer_from_geom(geometry, buffer);
+        if (m_stats.enabled()) {
+            m_stats.add_vertices(Stage::buffer, count_vertices(geometry));
+        }
+    }
+}
+
+void GDALIntersectingTilesFinder::handle_boost_geometry(bgeometry_t geometry, const double buffer_size) {
+    prepare_geometry(geometry, buffer_size);
+    // 4) Split multi geometries into their parts. The envelope of a multi geometry can be much
+    // larger than the sum of the envelopes of its parts (e.g. islands spread over an ocean) and
+    // every tile in it would be checked against all parts.
+    switch (geometry.index()) {
+    case 1:
+        add_parts(std::get<bmulti_point_t>(geometry));
+        break;
+    case 3:
+        add_parts(std::get<bmulti_linestring_t>(geometry));
+        break;
+    case 5:
+        add_parts(std::get<bmulti_polygon_t>(geometry));
+        break;
+    default:
+        add_tiles(geometry);
+    }
+}
+
+template <typename TMulti>
+void GDALIntersectingTilesFinder::add_parts(TMulti& multi) {
+    if (multi.size() == 1) {
+        bgeometry_t geometry {std::move(multi.front())};
+        add_tiles(geometry);
+        return;
     }
+    for (auto& part : multi) {
+        bgeometry_t geometry {std::move(part)};
+        box_t box;
+        {
+            StageTimer timer {m_stats, Stage::envelope};
+            box = get_envelope_from_geom(geometry);
+        }
+        if (box.min_corner().get<0>() > box.max_corner().get<0>()) {
+            continue;
+        }
+        // Parts often share their tiles with the parts before (e.g. small islands off a coast).
+        if (box.max_corner().get<0>() <= projection::mercator_max_value && tiles_already_covered(box, 0)) {
+            continue;
+        }
+        add_tiles(geometry, box);
+    }
+}
+
+void GDALIntersectingTilesFinder::add_tiles(bgeometry_t& geometry) {
+    box_t box;
+    {
+        StageTimer timer {m_stats, Stage::envelope};
+        box = get_envelope_from_geom(geometry);
+    }
+    add_tiles(geometry, box);
+}
+
+void GDALIntersectingTilesFinder::add_tiles(bgeometry_t& geometry, const box_t& box) {
+    for_each_side(geometry, box, [this](const bgeometry_t& g, const box_t& b, const bool clipped) {
+        // Parts exceeding the tile budget are computed at a lower zoom level.
+        const uint32_t zoom = coarse_zoom(g, b, clipped);
+        if (zoom < m_maxzoom && m_verbose) {
+            std::cerr << "Computing a geometry with more than " << m_max_tiles_per_feature
+                << " tiles at zoom level " << zoom << '\n';
+        }
+        scan_geometry(g, b, clipped, zoom);
+    });
+}
+
+template <typename TFunction>
+void GDALIntersectingTilesFinder::for_each_side(bgeometry_t& geometry, const box_t& box, TFunction&& func) {
+    const double min_x = box.min_corner().get<0>();
+    const double max_x = box.max_corner().get<0>();
+    if (max_x <= projection::mercator_max_value) {
+        func(geometry, box, false);
+        return;
+    }
+    // The geometry extends east of the antimeridian (after shifting it or buffering). The tiles
+    // west of the antimeridian are checked first, then the geometry is moved by the circumference
+    // of the earth to check the tiles of its part beyond the antimeridian.
+    const double min_y = box.min_corner().get<1>();
+    const double max_y = box.max_corner().get<1>();
+    const bool split = min_x < projection::mercator_max_value;
+    if (split) {
+        func(geometry, box_t{{min_x, min_y}, {projection::mercator_max_value, max_y}}, true);
+    }
+    {
+        StageTimer timer {m_stats, Stage::envelope};
+        shift_x(geometry, -projection::earth_circumfence, std::numeric_limits<double>::max());
+    }
+    const double west_min_x = split ? -projection::mercator_max_value : min_x - projection::earth_circumfence;
+    func(geometry, box_t{{west_min_x, min_y}, {max_x - projection::earth_circumfence, max_y}}, split);
+}
+
+void GDALIntersectingTilesFinder::scan_geometry(const bgeometry_t& geometry, const box_t& box, const bool clipped,
+        const uint32_t zoom) {
     // 5) create tiles in bounding box
     ZoomRange tile_range = ZoomRange::from_bbox_webmerc(box.min_corner().get<0>(),
-            box.min_corner().get<1>(), box.max_corner().get<0>(), box.max_corner().get<1>(), m_maxzoom);
+            box.min_corner().get<1>(), box.max_corner().get<0>(), box.max_corner().get<1>(), zoom);
+    // Shortcut: If zoom range is 1 tile wide or high (i.e. difference between min and max
+    // is 0), all tiles in the range intersect and the intersection check is skipped. This
+    // does not apply if the box is only a part of the envelope.
+    const bool check_required = clipped || (tile_range.width() != 0 && tile_range.height() != 0);
+    // Only areal geometries can cover a tile completely.
+    const bool classify = m_classify && is_areal(geometry);
+    // Large geometries get an index of their edges.
+    std::unique_ptr<SegmentIndex> index;
+    std::unique_ptr<TileSpaceIndex> tile_space_index;
+    if (check_required && m_index_threshold > 0 && count_vertices(geometry) >= m_index_threshold) {
+        StageTimer timer {m_stats, Stage::index};
+        if (m_fixed_point && TileSpaceIndex::supports(geometry, zoom)) {
+            tile_space_index.reset(new TileSpaceIndex(geometry, zoom));
+            m_stats.add_vertices(Stage::index, tile_space_index->size());
+        } else if (SegmentIndex::supports(geometry)) {
+            index.reset(new SegmentIndex(geometry));
+            m_stats.add_vertices(Stage::index, index->size());
+        }
+    }
     // 6) check which tiles intersect, add them to the tile list
-    for (uint32_t x = tile_range.xmin; x <= tile_range.xmax; ++x) {
-        for (uint32_t y = tile_range.ymin; y <= tile_range.ymax; ++y) {
-            // Shortcut: If zoom range is 1 tile wide or high (i.e. difference between min and max
-            // is 0), skip the intersection check.
-            if (tile_range.width() == 0 || tile_range.height() == 0) {
-                m_tile_list.add_tile(x, y);
-                continue;
+    const TileScan scan {geometry, index.get(), tile_space_index.get(), check_required, classify, zoom};
+    const uint64_t tile_count = static_cast<uint64_t>(tile_range.width() + 1) * (tile_range.height() + 1);
+    if (m_threads > 1 && tile_count >= parallel_min_tiles) {
+        scan_tiles_parallel(scan, tile_range);
+        return;
+    }
+    uint64_t tiles_accepted = 0;
+    uint64_t tiles_tested = scan_tiles(scan, tile_range, m_stats, [this, zoom, &tiles_accepted](uint32_t x, uint32_t y, bool full) {
+        add_scanned_tile(zoom, x, y, full);
+        ++tiles_accepted;
+    });
+    m_stats.add_tiles_tested(tiles_tested);
+    m_stats.add_tiles_accepted(tiles_accepted);
+}
+
+template <typename TSink>
+uint64_t GDALIntersectingTilesFinder::scan_tiles(const TileScan& scan, const ZoomRange& range, Stats& stats,
+        TSink&& sink) const {
+    if (scan.index || scan.tile_space_index) {
+        return scan_tiles_indexed(scan, range, stats, sink);
+    }
+    uint64_t tiles_tested = 0;
+    // The edges of the tiles are converted once per row and column, not for every tile.
+    const uint32_t row_count = range.height() + 1;
+    std::vector<double> row_edges(row_count + 1);
+    for (uint32_t i = 0; i <= row_count; ++i) {
+        row_edges[i] = projection::tile_y_to_merc(range.ymin + i, scan.zoom);
+    }
+    // The tiles of a column are checked in one pass per stage, each timed once.
+    std::vector<uint8_t> column(row_count);
+    for (uint32_t x = range.xmin; x <= range.xmax; ++x) {
+        const double x0 = projection::tile_x_to_merc(x, scan.zoom);
+        const double x1 = projection::tile_x_to_merc(x + 1, scan.zoom);
+        if (scan.check_required) {
+            StageTimer timer {stats, Stage::intersects};
+            for (uint32_t i = 0; i < row_count; ++i) {
+                const box_t tile_box {{x0, row_edges[i + 1]}, {x1, row_edges[i]}};
+                column[i] = geoms_intersect(scan.geometry, tile_box) ? tile_accepted : 0;
+            }
+            timer.set_calls(row_count);
+            tiles_tested += row_count;
+        } else {
+            std::fill(column.begin(), column.end(), tile_accepted);
+        }
+        // check if the tiles are fully covered by the geometry
+        if (scan.classify) {
+            StageTimer timer {stats, Stage::classify};
+            uint64_t classified = 0;
+            for (uint32_t i = 0; i < row_count; ++i) {
+                if (column[i]) {
+                    const box_t tile_box {{x0, row_edges[i + 1]}, {x1, row_edges[i]}};
+                    if (geom_covers_box(scan.geometry, tile_box)) {
+                        column[i] |= tile_full;
+                    }
+                    ++classified;
+                }
+            }
+            timer.set_calls(classified);
+        }
+        sink_column(x, range.ymin, column, stats, sink);
+    }
+    return tiles_tested;
+}
+
+template <typename TSink>
+/*static*/ void GDALIntersectingTilesFinder::sink_column(const uint32_t x, const uint32_t ymin,
+        const std::vector<uint8_t>& column, Stats& stats, TSink& sink) {
+    StageTimer timer {stats, Stage::insert};
+    uint64_t accepted = 0;
+    for (uint32_t i = 0; i < column.size(); ++i) {
+        if (column[i]) {
+            sink(x, ymin + i, (column[i] & tile_full) != 0);
+            ++accepted;
+        }
+    }
+    timer.set_calls(accepted);
+}
+
+template <typename TSink>
+uint64_t GDALIntersectingTilesFinder::scan_tiles_indexed(const TileScan& scan, const ZoomRange& range, Stats& stats,
+        TSink&& sink) const {
+    const uint32_t row_count = range.height() + 1;
+    std::vector<double> row_edges(row_count + 1);
+    for (uint32_t i = 0; i <= row_count; ++i) {
+        row_edges[i] = projection::tile_y_to_merc(range.ymin + i, scan.zoom);
+    }
+    SegmentBatch batch;
+    std::vector<uint64_t> hits;
+    std::vector<uint8_t> column(row_count);
+    for (uint32_t x = range.xmin; x <= range.xmax; ++x) {
+        const double x0 = projection::tile_x_to_merc(x, scan.zoom);
+        const double x1 = projection::tile_x_to_merc(x + 1, scan.zoom);
+        {
+            // Mark all tiles of the column intersected by an edge at once.
+            StageTimer timer {stats, Stage::intersects};
+            if (scan.tile_space_index) {
+                scan.tile_space_index->mark_column(x, range.ymin, row_count, hits);
+            } else {
+                batch.clear();
+                scan.index->query(box_t{{x0, row_edges.back()}, {x1, row_edges.front()}}, batch);
+                batch.mark_column(x0, x1, row_edges, hits);
+            }
+        }
+        /* Two adjacent tiles which are not intersected by any edge are both inside or both
+         * outside the geometry. Therefore, the point-in-polygon test is only required for
+         * the first tile after a tile intersected by an edge. */
+        {
+            StageTimer timer {stats, Stage::intersects};
+            uint64_t point_tests = 0;
+            bool inside_known = false;
+            bool inside = false;
+            for (uint32_t i = 0; i < row_count; ++i) {
+                if (hits[i / 64] & (uint64_t{1} << (i % 64))) {
+                    inside_known = false;
+                    column[i] = tile_accepted;
+                    continue;
+                }
+                if (!inside_known) {
+                    if (scan.tile_space_index) {
+                        inside = scan.tile_space_index->contains_tile_center(x, range.ymin + i);
+                    } else {
+                        inside = scan.index->contains(bpoint_t{(x0 + x1) / 2, (row_edges[i] + row_edges[i + 1]) / 2});
+                    }
+                    inside_known = true;
+                    ++point_tests;
+                }
+                column[i] = inside ? (scan.classify ? tile_accepted | tile_full : tile_accepted) : 0;
             }
-            // create tile
-            // check if bounding box of the geometry in the shape file is fully covered by the tile
-            box_t tile_box {
-                {projection::tile_x_to_merc(x, m_maxzoom), projection::tile_y_to_merc(y + 1, m_maxzoom)},
-                {projection::tile_x_to_merc(x + 1, m_maxzoom), projection::tile_y_to_merc(y, m_maxzoom)}
-            };
-            if (geoms_intersect(buffered, box)) {
-                m_tile_list.add_tile(x, y);
+            timer.set_calls(point_tests);
+        }
+        sink_column(x, range.ymin, column, stats, sink);
+    }
+    return static_cast<uint64_t>(range.width() + 1) * row_count;
+}
+
+void GDALIntersectingTilesFinder::scan_tiles_parallel(const TileScan& scan, const ZoomRange& range) {
+    // Split the range into square blocks. Their results are merged into the tile list in waves
+    // to limit the memory needed for results which have not been merged yet.
+    std::vector<ZoomRange> blocks;
+    for (uint32_t x = range.xmin; x <= range.xmax; x += parallel_block_size) {
+        for (uint32_t y = range.ymin; y <= range.ymax; y += parallel_block_size) {
+            blocks.emplace_back(x, std::min(x + parallel_block_size - 1, range.xmax),
+                    y, std::min(y + parallel_block_size - 1, range.ymax));
+        }
+    }
+    struct TileHit {
+        uint32_t x;
+        uint32_t y;
+        bool full;
+    };
+    const size_t wave_size = static_cast<size_t>(m_threads) * 16;
+    std::vector<std::vector<TileHit>> hits(wave_size);
+    std::vector<uint64_t> tested(wave_size);
+    uint64_t tiles_tested = 0;
+    uint64_t tiles_accepted = 0;
+    for (size_t first = 0; first < blocks.size(); first += wave_size) {
+        const size_t count = std::min(wave_size, blocks.size() - first);
+        {
+            StageTimer timer {m_stats, Stage::intersects};
+            // Stats are not thread-safe, workers report to a disabled instance.
+            parallel_for(count, m_threads, [&](const size_t i) {
+                hits[i].clear();
+                tested[i] = scan_tiles(scan, blocks[first + i], Stats::disabled(), [&hits, i](uint32_t x, uint32_t y, bool full) {
+                    hits[i].push_back(TileHit{x, y, full});
+                });
+            });
+        }
+        StageTimer timer {m_stats, Stage::insert};
+        uint64_t wave_accepted = 0;
+        for (size_t i = 0; i < count; ++i) {
+            for (const TileHit& hit : hits[i]) {
+                add_scanned_tile(scan.zoom, hit.x, hit.y, hit.full);
             }
+            tiles_tested += tested[i];
+            wave_accepted += hits[i].size();
         }
+        timer.set_calls(wave_accepted);
+        tiles_accepted += wave_accepted;
+    }
+    m_stats.add_tiles_tested(tiles_tested);
+    m_stats.add_tiles_accepted(tiles_accepted);
+}
+
+void GDALIntersectingTilesFinder::add_scanned_tile(const uint32_t zoom, const uint32_t x, const uint32_t y,
+        const bool full) {
+    if (zoom == m_maxzoom) {
+        m_tile_list.add_tile(x, y, full);
+    } else {
+        m_tile_list.add_subtree(zoom, x, y, full);
+    }
+}
+
+/*static*/ uint64_t GDALIntersectingTilesFinder::envelope_tile_count(const box_t& box, const uint32_t zoom) {
+    const double min_x = box.min_corner().get<0>();
+    const double max_x = box.max_corner().get<0>();
+    auto count = [&box, zoom](const double x1, const double x2) {
+        const ZoomRange range = ZoomRange::from_bbox_webmerc(x1, box.min_corner().get<1>(), x2,
+                box.max_corner().get<1>(), zoom);
+        return static_cast<uint64_t>(range.width() + 1) * (range.height() + 1);
+    };
+    // envelopes extending east of the antimeridian, see for_each_side()
+    if (max_x <= projection::mercator_max_value) {
+        return count(min_x, max_x);
+    }
+    if (min_x >= projection::mercator_max_value) {
+        return count(min_x - projection::earth_circumfence, max_x - projection::earth_circumfence);
+    }
+    return count(min_x, projection::mercator_max_value)
+        + count(-projection::mercator_max_value, max_x - projection::earth_circumfence);
+}
+
+uint32_t GDALIntersectingTilesFinder::coarse_zoom(const bgeometry_t& geometry, const box_t& box,
+        const bool clipped) {
+    if (m_max_tiles_per_feature == 0 || envelope_tile_count(box, m_maxzoom) <= m_max_tiles_per_feature) {
+        return m_maxzoom;
+    }
+    /* The envelope overestimates the tiles of thin or diagonal lines and of sparse geometries by
+     * orders of magnitude. The tiles are counted at low zoom levels instead. */
+    std::vector<std::vector<uint64_t>> tiles(m_maxzoom + 1);
+    std::vector<double> extrapolated(m_maxzoom + 1);
+    count_tiles(geometry, box, clipped, tiles, extrapolated);
+    const double max_tiles = static_cast<double>(m_max_tiles_per_feature);
+    uint32_t zoom = m_maxzoom;
+    while (zoom > 0 && static_cast<double>(tiles[zoom].size()) + extrapolated[zoom] > max_tiles) {
+        --zoom;
+    }
+    return zoom;
+}
+
+void GDALIntersectingTilesFinder::count_tiles(bgeometry_t& geometry, std::vector<std::vector<uint64_t>>& tiles,
+        std::vector<double>& extrapolated) {
+    box_t box;
+    {
+        StageTimer timer {m_stats, Stage::envelope};
+        box = get_envelope_from_geom(geometry);
+    }
+    // empty geometry
+    if (box.min_corner().get<0>() > box.max_corner().get<0>()) {
+        return;
+    }
+    for_each_side(geometry, box, [this, &tiles, &extrapolated](const bgeometry_t& g, const box_t& b,
+            const bool clipped) {
+        count_tiles(g, b, clipped, tiles, extrapolated);
+    });
+}
+
+void GDALIntersectingTilesFinder::count_tiles(const bgeometry_t& geometry, const box_t& box, const bool clipped,
+        std::vector<std::vector<uint64_t>>& tiles, std::vector<double>& extrapolated) {
+    std::unique_ptr<SegmentIndex> index;
+    bool index_checked = false;
+    double previous = 0;
+    double last = 0;
+    uint32_t zoom = 0;
+    for (; zoom <= m_maxzoom; ++zoom) {
+        const ZoomRange range = ZoomRange::from_bbox_webmerc(box.min_corner().get<0>(), box.min_corner().get<1>(),
+                box.max_corner().get<0>(), box.max_corner().get<1>(), zoom);
+        const uint64_t tile_count = static_cast<uint64_t>(range.width() + 1) * (range.height() + 1);
+        if (tile_count > estimate_max_tiles) {
+            break;
+        }
+        const bool check_required = clipped || (range.width() != 0 && range.height() != 0);
+        if (check_required && !index_checked) {
+            index_checked = true;
+            if (m_index_threshold > 0 && count_vertices(geometry) >= m_index_threshold
+                    && SegmentIndex::supports(geometry)) {
+                StageTimer timer {m_stats, Stage::index};
+                index.reset(new SegmentIndex(geometry));
+            }
+        }
+        const TileScan scan {geometry, index.get(), nullptr, check_required, false, zoom};
+        std::vector<uint64_t>& zoom_tiles = tiles[zoom];
+        const size_t size_before = zoom_tiles.size();
+        {
+            StageTimer timer {m_stats, Stage::intersects};
+            scan_tiles(scan, range, Stats::disabled(), [&zoom_tiles, zoom](uint32_t x, uint32_t y, bool) {
+                zoom_tiles.push_back(TileList::xy_to_quadkey(x, y, zoom));
+            });
+        }
+        previous = last;
+        last = static_cast<double>(zoom_tiles.size() - size_before);
+    }
+    if (zoom > m_maxzoom) {
+        return;
+    }
+    // Extrapolate the growth of the last zoom levels counted exactly: about 2 per zoom level for
+    // lines and 4 for areas. It cannot exceed the tiles of the envelope.
+    const double growth = previous > 0 ? std::min(std::max(last / previous, 1.0), 4.0) : 4.0;
+    for (; zoom <= m_maxzoom; ++zoom) {
+        const ZoomRange range = ZoomRange::from_bbox_webmerc(box.min_corner().get<0>(), box.min_corner().get<1>(),
+                box.max_corner().get<0>(), box.max_corner().get<1>(), zoom);
+        last = std::min(last * growth, static_cast<double>(range.width() + 1) * (range.height() + 1));
+        extrapolated[zoom] += last;
     }
 }
 
+/*static*/ double GDALIntersectingTilesFinder::buffer_in_merc(const double buffer_size, const double min_y,
+        const double max_y) {
+    double avg_lat = (max_y - min_y) / 2 + min_y;
+    double scale = projection::mercator_scale(projection::y_to_lat(avg_lat));
+    return buffer_size * scale;
+}
+
+bool GDALIntersectingTilesFinder::tiles_already_covered(const OGRGeometry* geometry, const double buffer_size) {
+    OGREnvelope envelope;
+    {
+        StageTimer timer {m_stats, Stage::precheck};
+        geometry->getEnvelope(&envelope);
+    }
+    return tiles_already_covered(box_t{{envelope.MinX, envelope.MinY}, {envelope.MaxX, envelope.MaxY}}, buffer_size);
+}
+
+bool GDALIntersectingTilesFinder::tiles_already_covered(const box_t& envelope, const double buffer_size) {
+    StageTimer timer {m_stats, Stage::precheck};
+    const double min_x = envelope.min_corner().get<0>();
+    const double min_y = envelope.min_corner().get<1>();
+    const double max_x = envelope.max_corner().get<0>();
+    const double max_y = envelope.max_corner().get<1>();
+    // The buffer does not grow beyond its radius, therefore the expanded envelope contains
+    // the envelope of the buffered geometry.
+    double buffer = (buffer_size > 0) ? buffer_in_merc(buffer_size, min_y, max_y) : 0;
+    ZoomRange range = ZoomRange::from_bbox_webmerc(min_x - buffer, min_y - buffer, max_x + buffer, max_y + buffer,
+            m_maxzoom);
+    /* Single tiles are looked up one by one, this is only worth it for small envelopes. Larger
+     * envelopes can still be inside of bounding boxes or coarsened features. */
+    const bool check_single_tiles = static_cast<uint64_t>(range.width() + 1) * (range.height() + 1)
+        <= max_precheck_tiles;
+    // If classification is enabled, another feature could turn a boundary tile into a full tile.
+    return m_tile_list.contains_range(range, m_classify, check_single_tiles);
+}
+
+/*static*/ bool GDALIntersectingTilesFinder::is_areal(const bgeometry_t& geom) {
+    return std::holds_alternative<bpolygon_t>(geom) || std::holds_alternative<bmulti_polygon_t>(geom);
+}
+
+/*static*/ bool GDALIntersectingTilesFinder::geom_covers_box(const bgeometry_t& geom, const box_t& box) {
+    // Boost Geometry does not implement covered_by for a box and a polygon.
+    bpolygon_t box_polygon;
+    bgeom::convert(box, box_polygon);
+    if (std::holds_alternative<bpolygon_t>(geom)) {
+        return bgeom::covered_by(box_polygon, std::get<bpolygon_t>(geom));
+    } else if (std::holds_alternative<bmulti_polygon_t>(geom)) {
+        return bgeom::covered_by(box_polygon, std::get<bmulti_polygon_t>(geom));
+    }
+    return false;
+}
+
+/*static*/ bool GDALIntersectingTilesFinder::crosses_antimeridian(const bgeometry_t& geom) {
+    return std::visit([](const auto& g) {
+        bool crosses = false;
+        using geometry_type = std::decay_t<decltype(g)>;
+        if constexpr (!std::is_same_v<geometry_type, bpoint_t> && !std::is_same_v<geometry_type, bmulti_point_t>) {
+            // Edges between two points on the antimeridian run along the edge of the map (e.g. the
+            // border of a polygon covering the whole map).
+            constexpr double edge = projection::mercator_max_value * (1 - 1e-9);
+            bgeom::for_each_segment(g, [&crosses](const auto& segment) {
+                const double x0 = bgeom::get<0, 0>(segment);
+                const double x1 = bgeom::get<1, 0>(segment);
+                const bool on_edge = std::abs(x0) >= edge && std::abs(x1) >= edge;
+                crosses |= !on_edge && std::abs(x1 - x0) > projection::mercator_max_value;
+            });
+        }
+        return crosses;
+    }, geom);
+}
+
+/*static*/ void GDALIntersectingTilesFinder::shift_x(bgeometry_t& geom, const double offset, const double limit) {
+    std::visit([offset, limit](auto& g) {
+        bgeom::for_each_point(g, [offset, limit](bpoint_t& point) {
+            if (point.x() < limit) {
+                point.x(point.x() + offset);
+            }
+        });
+    }, geom);
+}
+
+/*static*/ size_t GDALIntersectingTilesFinder::count_vertices(const bgeometry_t& geom) {
+    return std::visit([](const auto& g) { return static_cast<size_t>(bgeom::num_points(g)); }, geom);
+}
+
 box_t GDALIntersectingTilesFinder::get_envelope_from_geom(const bgeometry_t& geom) {
     box_t box;
     if (std::holds_alternative<bpoint_t>(geom)) {
-        bpoint_t p = std::get<bpoint_t>(geom);
+        const bpoint_t& p = std::get<bpoint_t>(geom);
         bgeom::envelope(p, box);
     } else if (std::holds_alternative<bmulti_point_t>(geom)) {
-        bmulti_point_t p = std::get<bmulti_point_t>(geom);
+        const bmulti_point_t& p = std::get<bmulti_point_t>(geom);
         bgeom::envelope(p, box);
     } else if (std::holds_alternative<blinestring_t>(geom)) {
-        blinestring_t p = std::get<blinestring_t>(geom);
+        const blinestring_t& p = std::get<blinestring_t>(geom);
         bgeom::envelope(p, box);
     } else if (std::holds_alternative<bmulti_linestring_t>(geom)) {
-        bmulti_linestring_t p = std::get<bmulti_linestring_t>(geom);
+        const bmulti_linestring_t& p = std::get<bmulti_linestring_t>(geom);
         bgeom::envelope(p, box);
     } else if (std::holds_alternative<bpolygon_t>(geom)) {
-        bpolygon_t p = std::get<bpolygon_t>(geom);
+        const bpolygon_t& p = std::get<bpolygon_t>(geom);
         bgeom::envelope(p, box);
     } else if (std::holds_alternative<bmulti_polygon_t>(geom)) {
-        bmulti_polygon_t p = std::get<bmulti_polygon_t>(geom);
+        const bmulti_polygon_t& p = std::get<bmulti_polygon_t>(geom);
         bgeom::envelope(p, box);
     }
     return box;
@@ -132,26 +701,8 @@ bmulti_polygon_t GDALIntersectingTilesFinder::get_buffer_from_geom(bgeometry_t&
 }
 
 bool GDALIntersectingTilesFinder::geoms_intersect(const bgeometry_t& geom, const box_t& box) {
-    if (std::holds_alternative<bpoint_t>(geom)) {
-        bpoint_t p = std::get<bpoint_t>(geom);
-        return bgeom::intersects(p, box);
-    } else if (std::holds_alternative<bmulti_point_t>(geom)) {
-        bmulti_point_t p = std::get<bmulti_point_t>(geom);
-        return bgeom::intersects(p, box);
-    } else if (std::holds_alternative<blinestring_t>(geom)) {
-        blinestring_t p = std::get<blinestring_t>(geom);
-        return bgeom::intersects(p, box);
-    } else if (std::holds_alternative<bmulti_linestring_t>(geom)) {
-        bmulti_linestring_t p = std::get<bmulti_linestring_t>(geom);
-        return bgeom::intersects(p, box);
-    } else if (std::holds_alternative<bpolygon_t>(geom)) {
-        bpolygon_t p = std::get<bpolygon_t>(geom);
-        return bgeom::intersects(p, box);
-    } else if (std::holds_alternative<bmulti_polygon_t>(geom)) {
-        bmulti_polygon_t p = std::get<bmulti_polygon_t>(geom);
-        return bgeom::intersects(p, box);
-    }
-    return false;
+    // Access the alternatives by reference, copying the geometry for every tile is expensive.
+    return std::visit([&box](const auto& g) { return bgeom::intersects(g, box); }, geom);
 }
 
 void GDALIntersectingTilesFinder::end_progress() {
@@ -161,22 +712,32 @@ void GDALIntersectingTilesFinder::end_progress() {
 }
 
 void GDALIntersectingTilesFinder::progress() {
+    m_stats.add_feature();
     if (!m_verbose) {
         return;
     }
     ++m_features;
     if (m_features % 10 == 0) {
-        fprintf(stderr, "\r%ld features processed", m_features);
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_layer_start).count();
+        double rate = (elapsed > 0) ? m_features / elapsed : 0;
+        if (m_layer_feature_count > 0 && rate > 0) {
+            double remaining = std::max<double>(0, m_layer_feature_count - static_cast<int64_t>(m_features)) / rate;
+            fprintf(stderr, "\r%ld of %ld features processed, %.0f features/s, ETA %ld:%02ld:%02ld   ",
+                    m_features, m_layer_feature_count, rate, static_cast<long>(remaining) / 3600,
+                    (static_cast<long>(remaining) / 60) % 60, static_cast<long>(remaining) % 60);
+        } else {
+            fprintf(stderr, "\r%ld features processed, %.0f features/s   ", m_features, rate);
+        }
     }
 }
 
-void GDALIntersectingTilesFinder::reset_progress() {
-    if (m_verbose) {
-        m_features = 0;
-    }
+void GDALIntersectingTilesFinder::reset_progress(const int64_t feature_count) {
+    m_layer_feature_count = feature_count;
+    m_layer_start = std::chrono::steady_clock::now();
+    m_features = 0;
 }
 
-void GDALIntersectingTilesFinder::output(FILE* output_file, const std::string& suffix,
+void GDALIntersectingTilesFinder::output(OutputFile& output_file, const std::string& suffix,
         const char delimiter, const std::string& path) {
     m_tile_list.output(output_file, m_minzoom, suffix, delimiter, path);
 }
@@ -185,26 +746,368 @@ void GDALIntersectingTilesFinder::handle_geometry(OGRGeometry* geometry,
         OGRCoordinateTransformation* transformation, const double buffer_size) {
     // steps to do:
     // 1) transform to EPSG:3857
-    if (geometry->transform(transformation) != OGRERR_NONE) {
-        std::cerr << "Failed to transform geometry\n";
-        exit(1);
+    {
+        StageTimer timer {m_stats, Stage::transform};
+        if (geometry->transform(transformation) != OGRERR_NONE) {
+            std::cerr << "Failed to transform geometry\n";
+            exit(1);
+        }
+    }
+    // 2) skip the feature if it cannot add any new tile, all features are needed for the cache
+    if (!m_cache_writer && tiles_already_covered(geometry, buffer_size)) {
+        m_stats.add_feature_skipped();
+        return;
+    }
+    bgeometry_t geom;
+    {
+        StageTimer timer {m_stats, Stage::convert};
+        geom = ogr2boost_geom(geometry);
+    }
+    if (m_stats.enabled()) {
+        m_stats.add_vertices(Stage::convert, count_vertices(geom));
+    }
+    if (m_cache_writer) {
+        {
+            StageTimer timer {m_stats, Stage::cache};
+            m_cache_writer->add(geom);
+        }
+        if (tiles_already_covered(geometry, buffer_size)) {
+            m_stats.add_feature_skipped();
+            return;
+        }
     }
-    bgeometry_t geom = ogr2boost_geom(geometry);
     handle_boost_geometry(std::move(geom), buffer_size);
 }
 
-void GDALIntersectingTilesFinder::handle_layer(OGRLayer* layer, const double buffer_size) {
-    OGRFeature* feature;
+void GDALIntersectingTilesFinder::handle_layer(OGRLayer* layer, const int64_t feature_count, const double buffer_size) {
     layer->ResetReading();
     std::unique_ptr<OGRCoordinateTransformation> tranformation {OGRCreateCoordinateTransformation(layer->GetSpatialRef(), &m_web_merc_ref)};
+    const uint64_t position = resume_position();
+    reset_progress(feature_count - static_cast<int64_t>(position));
+    m_stats.begin_layer(layer->GetName(), feature_count);
+    if (!m_sort_features) {
+        read_in_file_order(layer, tranformation.get(), position, buffer_size);
+    } else if (layer->TestCapability(OLCRandomRead)) {
+        read_sorted(layer, tranformation.get(), position, buffer_size);
+    } else {
+        read_sorted_chunks(layer, tranformation.get(), position, buffer_size);
+    }
+    m_stats.end_layer(std::chrono::steady_clock::now() - m_layer_start);
+    end_progress();
+}
+
+void GDALIntersectingTilesFinder::skip_features(OGRLayer* layer, const uint64_t position) {
+    if (position > 0 && layer->SetNextByIndex(static_cast<GIntBig>(position)) != OGRERR_NONE) {
+        layer->ResetReading();
+        OGRFeature* feature;
+        for (uint64_t i = 0; i < position && (feature = layer->GetNextFeature()) != NULL; ++i) {
+            OGRFeature::DestroyFeature(feature);
+        }
+    }
+}
 
-    reset_progress();
-    while ((feature = layer->GetNextFeature()) != NULL) {
+void GDALIntersectingTilesFinder::read_in_file_order(OGRLayer* layer, OGRCoordinateTransformation* transformation,
+        uint64_t position, const double buffer_size) {
+    // skip the features processed by a previous run
+    skip_features(layer, position);
+    OGRFeature* feature;
+    while (true) {
+        {
+            StageTimer timer {m_stats, Stage::read};
+            feature = layer->GetNextFeature();
+        }
+        if (feature == NULL) {
+            break;
+        }
         OGRGeometry* geom = feature->GetGeometryRef();
-        handle_geometry(geom, tranformation.get(), buffer_size);
+        handle_geometry(geom, transformation, buffer_size);
+        OGRFeature::DestroyFeature(feature);
+        progress();
+        checkpoint_if_due(++position);
+    }
+}
+
+void GDALIntersectingTilesFinder::read_sorted(OGRLayer* layer, OGRCoordinateTransformation* transformation,
+        uint64_t position, const double buffer_size) {
+    // 1st pass: sort key and ID of all features. The order is the same in every run, the features
+    // processed by a previous run are the first ones of the sorted list.
+    std::vector<std::pair<uint64_t, GIntBig>> order;
+    OGRFeature* feature;
+    while (true) {
+        {
+            StageTimer timer {m_stats, Stage::read};
+            feature = layer->GetNextFeature();
+        }
+        if (feature == NULL) {
+            break;
+        }
+        order.emplace_back(sort_key(feature->GetGeometryRef(), transformation), feature->GetFID());
         OGRFeature::DestroyFeature(feature);
+    }
+    {
+        StageTimer timer {m_stats, Stage::sort};
+        std::sort(order.begin(), order.end());
+    }
+    // 2nd pass: read the features by their ID
+    for (; position < order.size(); ++position) {
+        {
+            StageTimer timer {m_stats, Stage::read};
+            feature = layer->GetFeature(order[position].second);
+        }
+        if (feature == NULL) {
+            continue;
+        }
+        OGRGeometry* geom = feature->GetGeometryRef();
+        handle_geometry(geom, transformation, buffer_size);
+        OGRFeature::DestroyFeature(feature);
+        progress();
+        checkpoint_if_due(position + 1);
+    }
+}
+
+void GDALIntersectingTilesFinder::read_sorted_chunks(OGRLayer* layer, OGRCoordinateTransformation* transformation,
+        uint64_t position, const double buffer_size) {
+    skip_features(layer, position);
+    std::vector<std::pair<uint64_t, OGRFeature*>> chunk;
+    chunk.reserve(sort_chunk_size);
+    bool done = false;
+    while (!done) {
+        chunk.clear();
+        while (chunk.size() < sort_chunk_size) {
+            OGRFeature* feature;
+            {
+                StageTimer timer {m_stats, Stage::read};
+                feature = layer->GetNextFeature();
+            }
+            if (feature == NULL) {
+                done = true;
+                break;
+            }
+            chunk.emplace_back(sort_key(feature->GetGeometryRef(), transformation), feature);
+        }
+        {
+            StageTimer timer {m_stats, Stage::sort};
+            std::stable_sort(chunk.begin(), chunk.end(), [](const std::pair<uint64_t, OGRFeature*>& a,
+                    const std::pair<uint64_t, OGRFeature*>& b) {
+                return a.first < b.first;
+            });
+        }
+        for (auto& entry : chunk) {
+            handle_geometry(entry.second->GetGeometryRef(), transformation, buffer_size);
+            OGRFeature::DestroyFeature(entry.second);
+            progress();
+        }
+        // Checkpoints are only saved between two chunks, the features of a chunk are not processed in file order.
+        position += chunk.size();
+        checkpoint_if_due(position);
+    }
+}
+
+uint64_t GDALIntersectingTilesFinder::sort_key(const OGRGeometry* geometry, OGRCoordinateTransformation* transformation) {
+    if (geometry == NULL || geometry->IsEmpty()) {
+        return 0;
+    }
+    OGREnvelope envelope;
+    geometry->getEnvelope(&envelope);
+    double x = (envelope.MinX + envelope.MaxX) / 2;
+    double y = (envelope.MinY + envelope.MaxY) / 2;
+    if (!transformation->Transform(1, &x, &y)) {
+        return 0;
+    }
+    // position on a grid of 2^16 × 2^16 cells covering the map
+    const double cells = 1 << 16;
+    auto cell = [cells](const double v) {
+        const double c = (v + projection::mercator_max_value) / (2 * projection::mercator_max_value) * cells;
+        return static_cast<uint32_t>(std::min(std::max(c, 0.0), cells - 1));
+    };
+    return hilbert_index(cell(x), cell(projection::mercator_max_value - y), 16);
+}
+
+/*static*/ uint64_t GDALIntersectingTilesFinder::hilbert_index(uint32_t x, uint32_t y, const uint32_t order) {
+    uint64_t index = 0;
+    for (uint32_t s = 1u << (order - 1); s > 0; s >>= 1) {
+        const uint32_t rx = (x & s) > 0;
+        const uint32_t ry = (y & s) > 0;
+        index += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+        // rotate the quadrant
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return index;
+}
+
+void GDALIntersectingTilesFinder::handle_geometry_cache(const GeometryCache& cache, const char* layer_name,
+        const double buffer_size) {
+    const box_t filter_box {{projection::lon_to_x(m_filter_bbox.min_lon), projection::lat_to_y(m_filter_bbox.min_lat)},
+        {projection::lon_to_x(m_filter_bbox.max_lon), projection::lat_to_y(m_filter_bbox.max_lat)}};
+    // skip the features processed by a previous run
+    uint64_t position = resume_position();
+    const int64_t feature_count = static_cast<int64_t>(cache.size());
+    reset_progress(feature_count - static_cast<int64_t>(position));
+    m_stats.begin_layer(layer_name, feature_count);
+    bgeometry_t geometry;
+    for (; position < cache.size(); ++position) {
+        const GeometryCache::Entry entry = cache.entry(position);
+        const box_t envelope {{entry.min_x, entry.min_y}, {entry.max_x, entry.max_y}};
+        // The envelope of an empty geometry is inverted and does not intersect the filter.
+        if (!m_filter_enabled || bgeom::intersects(envelope, filter_box)) {
+            if (entry.min_x <= entry.max_x && tiles_already_covered(envelope, buffer_size)) {
+                m_stats.add_feature_skipped();
+            } else {
+                {
+                    StageTimer timer {m_stats, Stage::read};
+                    cache.read(entry, geometry);
+                }
+                if (m_stats.enabled()) {
+                    m_stats.add_vertices(Stage::convert, count_vertices(geometry));
+                }
+                handle_boost_geometry(std::move(geometry), buffer_size);
+            }
+        }
+        progress();
+        checkpoint_if_due(position + 1);
+    }
+    m_stats.end_layer(std::chrono::steady_clock::now() - m_layer_start);
+    end_progress();
+}
+
+void GDALIntersectingTilesFinder::handle_layer_caching(OGRLayer* layer, const std::string& cache_path,
+        const std::string& key, const int64_t feature_count, const double buffer_size) {
+    if (m_filter_enabled || resume_position() > 0) {
+        handle_layer(layer, feature_count, buffer_size);
+        return;
+    }
+    GeometryCacheWriter writer {cache_path, key};
+    m_cache_writer = &writer;
+    handle_layer(layer, feature_count, buffer_size);
+    m_cache_writer = nullptr;
+    StageTimer timer {m_stats, Stage::cache};
+    writer.commit();
+}
+
+uint64_t GDALIntersectingTilesFinder::resume_position() const {
+    return (m_checkpoint && m_checkpoint->layer() == m_layer_index) ? m_checkpoint->position() : 0;
+}
+
+void GDALIntersectingTilesFinder::checkpoint_if_due(const uint64_t position) {
+    if (m_checkpoint && m_checkpoint->due()) {
+        m_checkpoint->save(m_tile_list, m_layer_index, position);
+    }
+}
+
+void GDALIntersectingTilesFinder::set_spatial_filter(OGRLayer* layer) {
+    std::unique_ptr<OGRCoordinateTransformation> transformation {OGRCreateCoordinateTransformation(&m_wgs84_ref,
+            layer->GetSpatialRef())};
+    if (!transformation) {
+        std::cerr << "Failed to create transformation for the filter bounding box\n";
+        exit(1);
+    }
+    // The edges of the bounding box are curves in most projections, therefore they are sampled.
+    constexpr int steps = 32;
+    std::vector<double> xs;
+    std::vector<double> ys;
+    for (int i = 0; i <= steps; ++i) {
+        const double lon = m_filter_bbox.min_lon + (m_filter_bbox.max_lon - m_filter_bbox.min_lon) * i / steps;
+        const double lat = m_filter_bbox.min_lat + (m_filter_bbox.max_lat - m_filter_bbox.min_lat) * i / steps;
+        xs.insert(xs.end(), {lon, lon, m_filter_bbox.min_lon, m_filter_bbox.max_lon});
+        ys.insert(ys.end(), {m_filter_bbox.min_lat, m_filter_bbox.max_lat, lat, lat});
+    }
+    std::vector<int> success(xs.size(), 0);
+    transformation->Transform(xs.size(), xs.data(), ys.data(), nullptr, success.data());
+    OGREnvelope envelope;
+    for (size_t i = 0; i < xs.size(); ++i) {
+        if (success[i]) {
+            envelope.Merge(xs[i], ys[i]);
+        }
+    }
+    if (!envelope.IsInit()) {
+        std::cerr << "WARNING: Filter bounding box is outside of the area of use of layer " << layer->GetName() << '\n';
+        return;
+    }
+    layer->SetSpatialFilterRect(envelope.MinX, envelope.MinY, envelope.MaxX, envelope.MaxY);
+}
+
+void GDALIntersectingTilesFinder::handle_flatgeobuf(const FlatGeobufReader& reader, const double buffer_size) {
+    // Geographic coordinates are projected to Web Mercator while they are read.
+    const bool project = reader.crs_code() == 4326;
+    auto to_web_merc = [project](const FlatGeobufReader::Item& item) {
+        if (!project) {
+            return box_t{{item.min_x, item.min_y}, {item.max_x, item.max_y}};
+        }
+        return box_t{{projection::lon_to_x(item.min_x), projection::lat_to_y(item.min_y)},
+            {projection::lon_to_x(item.max_x), projection::lat_to_y(item.max_y)}};
+    };
+    // filter bounding box in the coordinate reference system of the file
+    FlatGeobufReader::Item filter {m_filter_bbox.min_lon, m_filter_bbox.min_lat, m_filter_bbox.max_lon,
+        m_filter_bbox.max_lat, 0};
+    if (!project) {
+        filter = {projection::lon_to_x(filter.min_x), projection::lat_to_y(filter.min_y),
+            projection::lon_to_x(filter.max_x), projection::lat_to_y(filter.max_y), 0};
+    }
+    const box_t filter_box = to_web_merc(filter);
+
+    std::vector<FlatGeobufReader::Item> items;
+    int64_t feature_count = (reader.feature_count() > 0) ? static_cast<int64_t>(reader.feature_count()) : -1;
+    if (m_filter_enabled && reader.has_index()) {
+        StageTimer timer {m_stats, Stage::read};
+        items = reader.search(filter);
+        feature_count = static_cast<int64_t>(items.size());
+    }
+    // skip the features processed by a previous run
+    uint64_t position = resume_position();
+    reset_progress(feature_count - static_cast<int64_t>(position));
+    m_stats.begin_layer(reader.name().c_str(), feature_count);
+
+    bgeometry_t geometry;
+    // Read and process the feature at an offset, returns the offset of the next feature.
+    auto handle_feature = [&](const uint64_t offset, const bool check_filter) {
+        uint64_t next;
+        bool valid;
+        {
+            StageTimer timer {m_stats, Stage::read};
+            valid = reader.read_feature(offset, project, geometry, next);
+        }
+        if (valid && check_filter) {
+            valid = bgeom::intersects(get_envelope_from_geom(geometry), filter_box);
+        }
+        if (valid) {
+            if (m_stats.enabled()) {
+                m_stats.add_vertices(Stage::convert, count_vertices(geometry));
+            }
+            handle_boost_geometry(std::move(geometry), buffer_size);
+        }
         progress();
+        return next;
+    };
+    if (reader.has_index()) {
+        // The bounding boxes in the index allow to skip features without reading their geometry.
+        const uint64_t count = m_filter_enabled ? items.size() : reader.feature_count();
+        for (; position < count; ++position) {
+            const FlatGeobufReader::Item item = m_filter_enabled ? items[position] : reader.item(position);
+            if (tiles_already_covered(to_web_merc(item), buffer_size)) {
+                m_stats.add_feature_skipped();
+                progress();
+            } else {
+                handle_feature(item.offset, false);
+            }
+            checkpoint_if_due(position + 1);
+        }
+    } else {
+        uint64_t offset = 0;
+        for (uint64_t i = 0; i < position && offset < reader.features_size(); ++i) {
+            offset = reader.next_feature(offset);
+        }
+        while (offset < reader.features_size()) {
+            offset = handle_feature(offset, m_filter_enabled);
+            checkpoint_if_due(++position);
+        }
     }
+    m_stats.end_layer(std::chrono::steady_clock::now() - m_layer_start);
     end_progress();
 }
 
@@ -235,6 +1138,16 @@ bgeometry_t GDALIntersectingTilesFinder::ogr2boost_geom(const OGRGeometry* ogr_g
         return ls;
         break;
     }
+    case wkbMultiLineString: {
+        bmulti_linestring_t mls;
+        const OGRMultiLineString* multi_linestring = ogr_geom->toMultiLineString();
+        for (auto it = multi_linestring->begin(); it != multi_linestring->end(); ++it) {
+            mls.resize(mls.size() + 1);
+            add_points_to_linestring(mls.back(), *it);
+        }
+        return mls;
+        break;
+    }
     case wkbPolygon: {
         return ogr_polygon2boost_geom(ogr_geom->toPolygon());
         break;
@@ -291,19 +1204,56 @@ void GDALIntersectingTilesFinder::add_polygon_to_multipolygon(bpolygon_t& multi_
     }
 }
 
-void GDALIntersectingTilesFinder::find_intersections(const std::string& path, const double buffer_size) {
+/*static*/ std::unique_ptr<GDALIntersectingTilesFinder::gdal_dataset_type> GDALIntersectingTilesFinder::open_dataset(
+        const std::string& path) {
     #if GDAL_VERSION_MAJOR >= 2
     std::unique_ptr<gdal_dataset_type> dataset {static_cast<gdal_dataset_type*>(GDALOpenEx(path.c_str(),
             GDAL_OF_VECTOR | GDAL_OF_READONLY | GDAL_OF_VERBOSE_ERROR, NULL, NULL, NULL))};
     #else
-    std::unique_ptr<gdal_dataset_type> dataset {OGRSFDriverRegistrar::Open(argv[optind + 1], FALSE)};
+    std::unique_ptr<gdal_dataset_type> dataset {OGRSFDriverRegistrar::Open(path.c_str(), FALSE)};
     #endif
     if (dataset == NULL) {
         std::cerr << "Opening " << path << " failed.\n";
         exit(1);
     }
+    return dataset;
+}
+
+void GDALIntersectingTilesFinder::find_intersections(const std::string& path, const double buffer_size) {
+    if (m_checkpoint && m_checkpoint->load(m_tile_list) && m_verbose) {
+        std::cerr << "Resuming at feature " << m_checkpoint->position() << " of layer " << m_checkpoint->layer()
+            << " with " << m_tile_list.size() << " tiles\n";
+    }
+    if (FlatGeobufReader::is_flatgeobuf(path)) {
+        try {
+            FlatGeobufReader reader {path};
+            const int32_t crs = reader.crs_code();
+            /* Files in other coordinate reference systems are read using GDAL, also files without
+             * an EPSG code: their coordinate reference system may be given as WKT only. */
+            if (crs == 4326 || crs == 3857 || crs == 900913) {
+                if (m_verbose) {
+                    std::cerr << "Processing " << reader.feature_count() << " features from " << path
+                        << " using the FlatGeobuf reader\n";
+                }
+                m_layer_index = 0;
+                if (!m_checkpoint || m_checkpoint->layer() == 0) {
+                    handle_flatgeobuf(reader, buffer_size);
+                }
+                if (m_checkpoint) {
+                    m_checkpoint->save(m_tile_list, 1, 0);
+                }
+                return;
+            }
+        } catch (const std::runtime_error& e) {
+            std::cerr << "ERROR: " << e.what() << '\n';
+            exit(1);
+        }
+    }
+    std::unique_ptr<gdal_dataset_type> dataset = open_dataset(path);
     int layer_count = dataset->GetLayerCount();
-    for (int i = 0; i < layer_count; ++i) {
+    // layers completed by a previous run are skipped
+    for (int i = m_checkpoint ? static_cast<int>(m_checkpoint->layer()) : 0; i < layer_count; ++i) {
+        m_layer_index = static_cast<size_t>(i);
         OGRLayer* layer = dataset->GetLayer(i);
         if (layer == NULL) {
             std::cerr << "WARNING: Skipping broken data layer " << i << " in " << path << '\n';
@@ -313,15 +1263,146 @@ void GDALIntersectingTilesFinder::find_intersections(const std::string& path, co
             std::cerr << "WARNING: Data layer " << i << " in " << path << " has no spatial reference. Skipping it.\n";
             continue;
         }
-        if (layer->GetFeatureCount() == 0) {
+        std::string cache_key;
+        std::string cache_path;
+        if (!m_geometry_cache_directory.empty()) {
+            try {
+                cache_key = GeometryCache::key(path, m_layer_index, layer->GetName());
+                cache_path = GeometryCache::path(m_geometry_cache_directory, cache_key);
+                std::unique_ptr<GeometryCache> cache = GeometryCache::open(cache_path, cache_key);
+                if (cache) {
+                    if (m_verbose) {
+                        std::cerr << "Processing " << cache->size() << " features of layer " << layer->GetName()
+                            << " from geometry cache " << cache_path << '\n';
+                    }
+                    handle_geometry_cache(*cache, layer->GetName(), buffer_size);
+                    continue;
+                }
+            } catch (const std::runtime_error& e) {
+                std::cerr << "ERROR: " << e.what() << '\n';
+                exit(1);
+            }
+        }
+        if (m_filter_enabled) {
+            set_spatial_filter(layer);
+        }
+        int64_t feature_count = layer->GetFeatureCount();
+        if (feature_count == 0) {
             std::cerr << "WARNING: Skipping empty layer " << layer->GetName() << " of " << path << '\n';
             continue;
         }
         if (m_verbose) {
-            std::cerr << "Processing " << layer->GetFeatureCount() << " features from layer " << layer->GetName() << " of " << path << '\n';
+            std::cerr << "Processing " << feature_count << " features from layer " << layer->GetName() << " of " << path << '\n';
+        }
+        if (cache_path.empty()) {
+            handle_layer(layer, feature_count, buffer_size);
+            continue;
+        }
+        try {
+            handle_layer_caching(layer, cache_path, cache_key, feature_count, buffer_size);
+        } catch (const std::runtime_error& e) {
+            std::cerr << "ERROR: " << e.what() << '\n';
+            exit(1);
         }
-        handle_layer(layer, buffer_size);
+    }
+    if (m_checkpoint) {
+        m_checkpoint->save(m_tile_list, static_cast<size_t>(layer_count), 0);
     }
 }
 
 
+
+void GDALIntersectingTilesFinder::estimate(const std::string& path, const double buffer_size,
+        const uint64_t sample_size, TileEstimate& estimate) {
+    std::unique_ptr<gdal_dataset_type> dataset = open_dataset(path);
+    // fixed seed, repeated runs give the same estimate
+    std::mt19937_64 random {0x50325454};
+    std::vector<std::vector<uint64_t>> tiles(m_maxzoom + 1);
+    std::vector<double> extrapolated(m_maxzoom + 1);
+    int layer_count = dataset->GetLayerCount();
+    for (int i = 0; i < layer_count; ++i) {
+        OGRLayer* layer = dataset->GetLayer(i);
+        if (layer == NULL) {
+            std::cerr << "WARNING: Skipping broken data layer " << i << " in " << path << '\n';
+            continue;
+        }
+        if (layer->GetSpatialRef() == NULL) {
+            std::cerr << "WARNING: Data layer " << i << " in " << path << " has no spatial reference. Skipping it.\n";
+            continue;
+        }
+        if (m_filter_enabled) {
+            set_spatial_filter(layer);
+        }
+        const int64_t feature_count = layer->GetFeatureCount();
+        if (feature_count <= 0) {
+            continue;
+        }
+        // Pick one feature from each of sample_size equal slices of the layer.
+        const uint64_t n = static_cast<uint64_t>(feature_count);
+        std::vector<uint64_t> sample;
+        if (n <= sample_size) {
+            sample.resize(n);
+            for (uint64_t j = 0; j < n; ++j) {
+                sample[j] = j;
+            }
+        } else {
+            for (uint64_t j = 0; j < sample_size; ++j) {
+                const uint64_t first = j * n / sample_size;
+                const uint64_t last = (j + 1) * n / sample_size - 1;
+                sample.push_back(std::uniform_int_distribution<uint64_t>{first, last}(random));
+            }
+        }
+        if (m_verbose) {
+            std::cerr << "Sampling " << sample.size() << " of " << feature_count << " features from layer "
+                << layer->GetName() << " of " << path << '\n';
+        }
+        estimate.begin_layer(layer->GetName(), n);
+        std::unique_ptr<OGRCoordinateTransformation> tranformation {OGRCreateCoordinateTransformation(layer->GetSpatialRef(), &m_web_merc_ref)};
+        // Drivers without fast random access are read sequentially, only the features of the
+        // sample are processed.
+        const bool random_access = layer->TestCapability(OLCFastSetNextByIndex);
+        layer->ResetReading();
+        uint64_t position = 0;
+        for (const uint64_t index : sample) {
+            OGRFeature* feature = NULL;
+            {
+                StageTimer timer {m_stats, Stage::read};
+                if (random_access) {
+                    if (layer->SetNextByIndex(static_cast<GIntBig>(index)) == OGRERR_NONE) {
+                        feature = layer->GetNextFeature();
+                    }
+                } else {
+                    for (; position < index && (feature = layer->GetNextFeature()) != NULL; ++position) {
+                        OGRFeature::DestroyFeature(feature);
+                    }
+                    feature = layer->GetNextFeature();
+                    ++position;
+                }
+            }
+            if (feature == NULL) {
+                break;
+            }
+            std::fill(extrapolated.begin(), extrapolated.end(), 0);
+            OGRGeometry* geometry = feature->GetGeometryRef();
+            if (geometry) {
+                {
+                    StageTimer timer {m_stats, Stage::transform};
+                    if (geometry->transform(tranformation.get()) != OGRERR_NONE) {
+                        std::cerr << "Failed to transform geometry\n";
+                        exit(1);
+                    }
+                }
+                bgeometry_t geom;
+                {
+                    StageTimer timer {m_stats, Stage::convert};
+                    geom = ogr2boost_geom(geometry);
+                }
+                prepare_geometry(geom, buffer_size);
+                count_tiles(geom, tiles, extrapolated);
+            }
+            OGRFeature::DestroyFeature(feature);
+            estimate.add_sample(tiles, extrapolated);
+        }
+        estimate.end_layer();
+    }
+}
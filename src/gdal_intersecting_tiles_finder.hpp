@@ -16,6 +16,8 @@
 #ifndef SRC_GDAL_INTERSECTING_TILES_FINDER_HPP_
 #define SRC_GDAL_INTERSECTING_TILES_FINDER_HPP_
 
+#include <algorithm>
+#include <chrono>
 #include <memory>
 #include <sstream>
 #include <string>
@@ -23,29 +25,18 @@
 #include <ogr_geometry.h>
 #include <ogrsf_frmts.h>
 #include <ogr_api.h>
+#include "geometry_types.hpp"
+#include "stats.hpp"
 #include "tile_list.hpp"
-#include <variant>
-#include <boost/geometry/geometries/adapted/c_array.hpp>
-#include <boost/geometry/geometries/point_xy.hpp>
-#include <boost/geometry/geometries/multi_point.hpp>
-#include <boost/geometry/geometries/linestring.hpp>
-#include <boost/geometry/geometries/multi_linestring.hpp>
-#include <boost/geometry/geometries/polygon.hpp>
-#include <boost/geometry/geometries/multi_polygon.hpp>
-#include <boost/geometry/geometries/box.hpp>
-
-
-namespace bgeom = boost::geometry;
-BOOST_GEOMETRY_REGISTER_C_ARRAY_CS(bgeom::cs::cartesian)
-using geometry_numeric_type = double;
-using bpoint_t = bgeom::model::d2::point_xy<geometry_numeric_type>;
-using bmulti_point_t = bgeom::model::multi_point<bpoint_t>;
-using blinestring_t = bgeom::model::linestring<bpoint_t>;
-using bmulti_linestring_t = bgeom::model::multi_linestring<blinestring_t>;
-using bpolygon_t = bgeom::model::polygon<bpoint_t>;
-using bmulti_polygon_t = bgeom::model::multi_polygon<bpolygon_t>;
-using box_t = bgeom::model::box<bpoint_t>;
-using bgeometry_t = std::variant<bpoint_t, bmulti_point_t, blinestring_t, bmulti_linestring_t, bpolygon_t, bmulti_polygon_t>;
+#include "utils.hpp"
+
+class Checkpoint;
+class FlatGeobufReader;
+class GeometryCache;
+class GeometryCacheWriter;
+class SegmentIndex;
+class TileEstimate;
+class TileSpaceIndex;
 
 
 class GDALIntersectingTilesFinder {
@@ -59,32 +50,355 @@ class GDALIntersectingTilesFinder {
 #endif
 
     size_t m_features;
+    /// number of features of the current layer as reported by GDAL, negative if unknown
+    int64_t m_layer_feature_count;
+    std::chrono::steady_clock::time_point m_layer_start;
     uint32_t m_minzoom;
     OGRSpatialReference m_web_merc_ref;
+    OGRSpatialReference m_wgs84_ref;
+    /// transformation from WGS84 to Web Mercator for geometries added via the in-memory API, created on first use
+    std::unique_ptr<OGRCoordinateTransformation> m_wgs84_transformation;
     bool m_verbose;
+    /// classify tiles as fully covered or boundary tiles
+    bool m_classify;
+    /// minimum number of vertices of a geometry to build a SegmentIndex, 0 to disable it
+    size_t m_index_threshold;
+    /// number of threads to check the tiles of a single large geometry
+    unsigned m_threads;
+    /// use fixed-point tile coordinates for the index of large geometries
+    bool m_fixed_point;
+    /// read only features whose bounding box intersects m_filter_bbox
+    bool m_filter_enabled;
+    BoundingBox m_filter_bbox;
+    /// state of the job to save at intervals, nullptr to disable checkpoints, not owned
+    Checkpoint* m_checkpoint;
+    /// index of the layer being read, used for checkpoints
+    size_t m_layer_index;
+    /// directory of the geometry cache files, empty to disable the cache
+    std::string m_geometry_cache_directory;
+    /// cache the geometries of the layer being read are written to, nullptr if none, not owned
+    GeometryCacheWriter* m_cache_writer;
+    /// features with more tiles at the maximum zoom level are computed at a lower zoom level, 0 to disable
+    uint64_t m_max_tiles_per_feature;
+    /// process the features of a layer in the order of their position on the map
+    bool m_sort_features;
     uint32_t m_maxzoom;
+    Stats& m_stats;
     TileList m_tile_list;
 
+    /**
+     * Make a geometry crossing the antimeridian continuous by moving its western part east
+     * and buffer the geometry.
+     *
+     * \param geometry geometry in Web Mercator coordinates, modified in place
+     * \param buffer_size buffer size in meter, 0 to disable buffering
+     */
+    void prepare_geometry(bgeometry_t& geometry, const double buffer_size);
+
     void handle_boost_geometry(bgeometry_t geometry, const double buffer_size);
 
+    /**
+     * Add the tiles of each part of a multi geometry separately. Parts whose envelope spans
+     * only tiles in the tile list already are skipped. The parts are moved out of the geometry.
+     */
+    template <typename TMulti>
+    void add_parts(TMulti& multi);
+
+    /**
+     * Add all tiles intersecting a (buffered) geometry to the tile list.
+     */
+    void add_tiles(bgeometry_t& geometry);
+
+    /**
+     * Add all tiles intersecting a (buffered) geometry with a known envelope to the tile list.
+     * The geometry may be moved west, see for_each_side().
+     */
+    void add_tiles(bgeometry_t& geometry, const box_t& box);
+
+    /**
+     * Call func(geometry, box, clipped) for the parts of the map covered by a geometry. Usually
+     * this is the envelope of the geometry. Geometries extending east of the antimeridian are
+     * wrapped around: func is called for the part of the envelope west of the antimeridian and
+     * then for the remainder after moving the geometry west by the circumference of the earth.
+     * clipped is true if the box passed is only a part of the envelope.
+     */
+    template <typename TFunction>
+    void for_each_side(bgeometry_t& geometry, const box_t& box, TFunction&& func);
+
+    /**
+     * Check the tiles in a box for intersection with a geometry and add them to the tile list.
+     *
+     * \param clipped the box is only a part of the envelope of the geometry
+     * \param zoom zoom level of the tiles checked, all descendants of tiles below the maximum zoom
+     *        level are added
+     */
+    void scan_geometry(const bgeometry_t& geometry, const box_t& box, const bool clipped, const uint32_t zoom);
+
+    /**
+     * Add a tile found by scan_geometry() to the tile list.
+     */
+    void add_scanned_tile(const uint32_t zoom, const uint32_t x, const uint32_t y, const bool full);
+
+    /**
+     * Number of tiles of a zoom level spanned by an envelope, which may extend east of the antimeridian.
+     */
+    static uint64_t envelope_tile_count(const box_t& box, const uint32_t zoom);
+
+    /**
+     * Get the deepest zoom level at which a geometry is expected to intersect at most
+     * m_max_tiles_per_feature tiles.
+     *
+     * The number of tiles is predicted by count_tiles(), i.e. counted at the zoom levels where the
+     * envelope is small and extrapolated from their growth. The envelope itself is only used to
+     * skip the prediction if it spans at most m_max_tiles_per_feature tiles at the maximum zoom level.
+     *
+     * \param clipped the box is only a part of the envelope of the geometry
+     */
+    uint32_t coarse_zoom(const bgeometry_t& geometry, const box_t& box, const bool clipped);
+
+    /**
+     * Everything needed to check the tiles of a range for intersection with a geometry
+     */
+    struct TileScan {
+        const bgeometry_t& geometry;
+        /// index of the edges of the geometry, nullptr if the geometry is checked directly
+        const SegmentIndex* index;
+        /// index of the edges in fixed-point tile coordinates, used instead of index if not nullptr
+        const TileSpaceIndex* tile_space_index;
+        /// false if all tiles of the range intersect
+        bool check_required;
+        /// determine if tiles are completely covered by the geometry
+        bool classify;
+        /// zoom level of the tiles
+        uint32_t zoom;
+    };
+
+    /**
+     * Minimum number of tiles in the envelope of a geometry to check them using multiple threads
+     */
+    static constexpr uint64_t parallel_min_tiles = 1 << 16;
+
+    /**
+     * Width and height of the blocks of tiles a range is split into for multi-threaded checks
+     */
+    static constexpr uint32_t parallel_block_size = 64;
+
+    /**
+     * Check all tiles of a range and call sink(x, y, full) for every intersecting tile.
+     *
+     * This method does not modify the tile list and can be called from multiple threads
+     * if stats is a disabled instance.
+     *
+     * \returns number of tiles checked for intersection
+     */
+    template <typename TSink>
+    uint64_t scan_tiles(const TileScan& scan, const ZoomRange& range, Stats& stats, TSink&& sink) const;
+
+    /**
+     * Implementation of scan_tiles() for geometries with a SegmentIndex or TileSpaceIndex. The tiles
+     * of a column are checked at once against the edges near the column.
+     */
+    template <typename TSink>
+    uint64_t scan_tiles_indexed(const TileScan& scan, const ZoomRange& range, Stats& stats, TSink&& sink) const;
+
+    /// Flags of the tiles of a column collected by scan_tiles()
+    static constexpr uint8_t tile_accepted = 1;
+    static constexpr uint8_t tile_full = 2;
+
+    /**
+     * Call sink(x, y, full) for all accepted tiles of a column. The calls are timed as
+     * Stage::insert together.
+     *
+     * \param column flags of the tiles of the column, starting at row ymin
+     */
+    template <typename TSink>
+    static void sink_column(const uint32_t x, const uint32_t ymin, const std::vector<uint8_t>& column,
+            Stats& stats, TSink& sink);
+
+    /**
+     * Check all tiles of a range in blocks using multiple threads and add the intersecting
+     * tiles to the tile list.
+     */
+    void scan_tiles_parallel(const TileScan& scan, const ZoomRange& range);
+
+    /**
+     * Tiles of a geometry per zoom level are only collected while its envelope spans at most
+     * this number of tiles. The counts of higher zoom levels are extrapolated.
+     */
+    static constexpr uint64_t estimate_max_tiles = 1 << 12;
+
+    /**
+     * Collect the tiles intersecting a prepared geometry at all zoom levels up to the maximum
+     * zoom level without adding them to the tile list, see estimate().
+     *
+     * \param tiles quadkeys of the tiles per zoom level, the tiles are appended to it
+     * \param extrapolated number of tiles per zoom level which are too many to be collected,
+     *        the counts are added to it
+     */
+    void count_tiles(bgeometry_t& geometry, std::vector<std::vector<uint64_t>>& tiles,
+            std::vector<double>& extrapolated);
+
+    void count_tiles(const bgeometry_t& geometry, const box_t& box, const bool clipped,
+            std::vector<std::vector<uint64_t>>& tiles, std::vector<double>& extrapolated);
+
     static box_t get_envelope_from_geom(const bgeometry_t& geom);
 
     static bmulti_polygon_t get_buffer_from_geom(bgeometry_t& geom, const double radius);
 
     static bool geoms_intersect(const bgeometry_t& geom, const box_t& box);
 
+    static size_t count_vertices(const bgeometry_t& geom);
+
+    /**
+     * Check if a geometry has an edge spanning more than half of the map. Such an edge is
+     * assumed to cross the antimeridian instead.
+     */
+    static bool crosses_antimeridian(const bgeometry_t& geom);
+
+    /**
+     * Add an offset to all x coordinates of a geometry which are less than a limit.
+     */
+    static void shift_x(bgeometry_t& geom, const double offset, const double limit);
+
+    /**
+     * Get the buffer radius in Web Mercator units at the average latitude of a geometry.
+     */
+    static double buffer_in_merc(const double buffer_size, const double min_y, const double max_y);
+
+    /**
+     * Maximum number of tiles in the envelope of a feature to look them up in the single tiles
+     * of the tile list. Checking larger envelopes tile by tile is too expensive and rarely
+     * successful, they are only looked up in the ranges of the tile list.
+     */
+    static constexpr uint64_t max_precheck_tiles = 64;
+
+    /**
+     * Check if all tiles in the (buffered) envelope of a transformed OGR geometry are in the tile list
+     * already. The feature cannot add any new tiles in that case and its conversion can be skipped.
+     */
+    bool tiles_already_covered(const OGRGeometry* geometry, const double buffer_size);
+
+    /**
+     * Check if all tiles in the (buffered) envelope of a feature in Web Mercator coordinates are
+     * in the tile list already.
+     */
+    bool tiles_already_covered(const box_t& envelope, const double buffer_size);
+
+    static bool is_areal(const bgeometry_t& geom);
+
+    /**
+     * Check if a box is completely covered by an areal geometry.
+     *
+     * \returns false if the geometry is not areal
+     */
+    static bool geom_covers_box(const bgeometry_t& geom, const box_t& box);
+
     void end_progress();
 
     void progress();
 
-    void reset_progress();
+    void reset_progress(const int64_t feature_count);
 
     void handle_geometry(OGRGeometry* geom, OGRCoordinateTransformation* transformation, const double buffer_size);
 
-    void handle_layer(OGRLayer* layer, const double buffer_size);
+    void handle_layer(OGRLayer* layer, const int64_t feature_count, const double buffer_size);
+
+    /**
+     * Number of features reordered at once if sorting is enabled and the driver does not support
+     * random access.
+     */
+    static constexpr size_t sort_chunk_size = 1 << 14;
+
+    /**
+     * Skip the first features of a layer, e.g. the features processed by a previous run.
+     */
+    void skip_features(OGRLayer* layer, const uint64_t position);
+
+    /**
+     * Process the features of a layer in the order of the file.
+     *
+     * \param position number of features processed by a previous run
+     */
+    void read_in_file_order(OGRLayer* layer, OGRCoordinateTransformation* transformation, uint64_t position,
+            const double buffer_size);
+
+    /**
+     * Process the features of a layer ordered by sort_key() of their geometries. The first pass reads
+     * the keys and IDs of all features, the second pass reads the features by their ID.
+     *
+     * \param position number of features in sorted order processed by a previous run
+     */
+    void read_sorted(OGRLayer* layer, OGRCoordinateTransformation* transformation, uint64_t position,
+            const double buffer_size);
+
+    /**
+     * Process the features of a layer in chunks of sort_chunk_size features. The features of a
+     * chunk are ordered by sort_key() of their geometries. Used if the driver does not support
+     * random access.
+     *
+     * \param position number of features processed by a previous run
+     */
+    void read_sorted_chunks(OGRLayer* layer, OGRCoordinateTransformation* transformation, uint64_t position,
+            const double buffer_size);
+
+    /**
+     * Get the key to sort features by: the index of the center of the envelope of the geometry on
+     * a Hilbert curve. Features with a small difference of their keys are close to each other.
+     */
+    static uint64_t sort_key(const OGRGeometry* geometry, OGRCoordinateTransformation* transformation);
+
+    /**
+     * Get the distance of a cell from the start of a Hilbert curve through a grid of 2^order × 2^order cells.
+     */
+    static uint64_t hilbert_index(uint32_t x, uint32_t y, const uint32_t order);
+
+    /**
+     * Read the geometries of a layer from a geometry cache file. The envelopes stored in the
+     * cache are used to skip features without reading their geometry.
+     */
+    void handle_geometry_cache(const GeometryCache& cache, const char* layer_name, const double buffer_size);
+
+    /**
+     * Read a layer and write its geometries to a new cache file. The cache is not written if only
+     * a part of the layer is read (filter bounding box or resuming from a checkpoint).
+     */
+    void handle_layer_caching(OGRLayer* layer, const std::string& cache_path, const std::string& key,
+            const int64_t feature_count, const double buffer_size);
+
+    /**
+     * Number of features of the current layer which have been processed by a previous run
+     * and have to be skipped.
+     */
+    uint64_t resume_position() const;
+
+    /**
+     * Save a checkpoint if it is due.
+     *
+     * \param position number of features of the current layer processed so far
+     */
+    void checkpoint_if_due(const uint64_t position);
+
+    /**
+     * Restrict the features read from an OGR layer to the filter bounding box.
+     */
+    void set_spatial_filter(OGRLayer* layer);
+
+    /**
+     * Open a dataset for reading. Exits the program if it fails.
+     */
+    static std::unique_ptr<gdal_dataset_type> open_dataset(const std::string& path);
+
+    /**
+     * Read the features of a FlatGeobuf file without GDAL. The geometries are read directly from
+     * the mapped file. If a filter bounding box is set, the features are selected using the
+     * spatial index of the file.
+     */
+    void handle_flatgeobuf(const FlatGeobufReader& reader, const double buffer_size);
 
     bgeometry_t ogr2boost_geom(const OGRGeometry* ogr_geom);
 
+    blinestring_t lonlat_to_linestring(const double* coords, const size_t point_count);
+
     void add_points_to_linestring(blinestring_t& ls, const OGRSimpleCurve* c);
 
     bpolygon_t ogr_polygon2boost_geom(const OGRPolygon* ogr_polygon);
@@ -96,11 +410,148 @@ class GDALIntersectingTilesFinder {
 public:
     GDALIntersectingTilesFinder() = delete;
 
-    GDALIntersectingTilesFinder(const bool verbose, uint32_t minzoom, uint32_t maxzoom, const bool check_tiles, const bool tirex);
+    GDALIntersectingTilesFinder(const bool verbose, uint32_t minzoom, uint32_t maxzoom, const bool check_tiles, const bool tirex,
+            const bool classify, Stats& stats = Stats::disabled());
 
     void find_intersections(const std::string& input_filepath, const double buffer_size);
 
-    void output(FILE* output_file, const std::string& suffix, const char delimiter, const std::string& path);
+    /**
+     * Estimate the number of tiles per zoom level of a geometry file without computing them.
+     *
+     * A stratified random sample of the features of each layer is read (one feature out of
+     * each of sample_size equal slices of the layer). Their tiles are collected per zoom level
+     * without adding them to the tile list. The tile list is not modified.
+     *
+     * \param sample_size number of features to read per layer
+     * \param estimate receives the tiles of the features sampled
+     */
+    void estimate(const std::string& input_filepath, const double buffer_size, const uint64_t sample_size,
+            TileEstimate& estimate);
+
+    /**
+     * Add all tiles intersecting with a geometry in Web Mercator coordinates (EPSG:3857).
+     *
+     * \param geometry geometry
+     * \param buffer_size buffer size in meter, 0 to disable buffering
+     */
+    void add_geometry(bgeometry_t geometry, const double buffer_size);
+
+    /**
+     * Add all tiles intersecting with a geometry encoded as WKB in WGS84 coordinates (EPSG:4326,
+     * longitude before latitude).
+     *
+     * \param wkb pointer to the WKB
+     * \param size size of the WKB in bytes
+     * \param buffer_size buffer size in meter, 0 to disable buffering
+     *
+     * \throws std::runtime_error if the WKB cannot be parsed or transformed
+     */
+    void add_wkb(const unsigned char* wkb, const size_t size, const double buffer_size);
+
+    /**
+     * Add all tiles intersecting with a linestring.
+     *
+     * \param coords interleaved longitude and latitude of the points (x1, y1, x2, y2, …)
+     * \param point_count number of points
+     * \param buffer_size buffer size in meter, 0 to disable buffering
+     */
+    void add_lonlat_linestring(const double* coords, const size_t point_count, const double buffer_size);
+
+    /**
+     * Add all tiles intersecting with a polygon without holes.
+     *
+     * \param coords interleaved longitude and latitude of the points of the outer ring
+     * \param point_count number of points
+     * \param buffer_size buffer size in meter, 0 to disable buffering
+     */
+    void add_lonlat_polygon(const double* coords, const size_t point_count, const double buffer_size);
+
+    /**
+     * Access the tiles found so far, e.g. to retrieve them using TileList::sorted_quadkeys()
+     * or TileList::for_each_tile().
+     */
+    TileList& tile_list() noexcept {
+        return m_tile_list;
+    }
+
+    /**
+     * Set the minimum number of vertices of a linear or areal geometry to check
+     * tiles for intersection using a SegmentIndex. Set to 0 to disable the index.
+     */
+    void set_index_threshold(const size_t vertices) noexcept {
+        m_index_threshold = vertices;
+    }
+
+    /**
+     * Set the number of threads used to check the tiles of a geometry whose envelope
+     * covers many tiles and to format the output.
+     */
+    void set_threads(const unsigned threads) noexcept {
+        m_threads = std::max(threads, 1u);
+        m_tile_list.set_threads(m_threads);
+    }
+
+    /**
+     * Build the index of large geometries in fixed-point tile coordinates (TileSpaceIndex)
+     * instead of Web Mercator coordinates (SegmentIndex).
+     */
+    void set_fixed_point(const bool fixed_point) noexcept {
+        m_fixed_point = fixed_point;
+    }
+
+    /**
+     * Read only features whose bounding box intersects a bounding box (in WGS84). The spatial
+     * index of the input file is used if it has one.
+     */
+    void set_filter_bbox(const BoundingBox& bbox) noexcept {
+        m_filter_enabled = true;
+        m_filter_bbox = bbox;
+    }
+
+    /**
+     * Save the position in the input and the tiles found at intervals and resume from the
+     * checkpoint of a previous run in find_intersections(). The checkpoint has to outlive
+     * this object.
+     */
+    void set_checkpoint(Checkpoint* checkpoint) noexcept {
+        m_checkpoint = checkpoint;
+        m_tile_list.track_added_tiles(checkpoint != nullptr);
+    }
+
+    /**
+     * Cache the transformed and converted geometries of the layers read using GDAL in a directory
+     * and read them from there if the input file has not been modified since.
+     */
+    void set_geometry_cache(const std::string& directory) {
+        m_geometry_cache_directory = directory;
+    }
+
+    /**
+     * Limit the number of tiles of a single feature. Each part of a multi geometry which is
+     * expected to intersect more tiles at the maximum zoom level is computed at the deepest zoom
+     * level where it intersects at most max_tiles tiles. All descendants of the tiles found at
+     * that level are added.
+     *
+     * \param max_tiles maximum number of tiles, 0 to disable the limit
+     */
+    void set_max_tiles_per_feature(const uint64_t max_tiles) noexcept {
+        m_max_tiles_per_feature = max_tiles;
+    }
+
+    /**
+     * Process the features of layers read with GDAL in the order of their position on the map
+     * (see read_sorted()) instead of the order of the file. Consecutive features add tiles to
+     * the same part of the tile list.
+     */
+    void set_sort_features(const bool sort) noexcept {
+        m_sort_features = sort;
+    }
+
+    uint32_t get_minzoom() const noexcept {
+        return m_minzoom;
+    }
+
+    void output(OutputFile& output_file, const std::string& suffix, const char delimiter, const std::string& path);
 };
 
 #endif /* SRC_GDAL_INTERSECTING_TILES_FINDER_HPP_ */
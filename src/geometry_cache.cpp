@@ -0,0 +1,388 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "geometry_cache.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+    constexpr char header_magic[] = "P2TLGEO1";
+
+    constexpr char trailer_magic[] = "P2TLEND1";
+
+    constexpr size_t magic_size = sizeof(header_magic) - 1;
+
+    /// key size, feature count, index offset and magic
+    constexpr size_t trailer_size = 3 * sizeof(uint64_t) + magic_size;
+
+    constexpr size_t entry_size = 4 * sizeof(double) + sizeof(uint64_t);
+
+    static_assert(sizeof(GeometryCache::Entry) == entry_size, "index entries are written as they are");
+
+    /// type and number of counts
+    constexpr size_t record_header_size = 2 * sizeof(uint32_t);
+
+    uint64_t read_uint64(const unsigned char* data) {
+        uint64_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    /**
+     * Bounds-checked access to a feature record
+     */
+    class RecordReader {
+
+        const unsigned char* m_counts;
+
+        uint32_t m_count_count;
+
+        uint32_t m_next_count = 0;
+
+        const unsigned char* m_coordinates;
+
+        /// number of points left in the mapped data
+        size_t m_points_left;
+
+        static std::runtime_error invalid() {
+            return std::runtime_error{"Invalid record in geometry cache"};
+        }
+
+    public:
+        RecordReader(const unsigned char* data, const size_t size, uint32_t& type) {
+            if (size < record_header_size) {
+                throw invalid();
+            }
+            memcpy(&type, data, sizeof(type));
+            memcpy(&m_count_count, data + sizeof(uint32_t), sizeof(m_count_count));
+            // counts are padded to 8 bytes
+            const size_t counts_size = (static_cast<size_t>(m_count_count) * sizeof(uint32_t) + 7) & ~static_cast<size_t>(7);
+            if (counts_size > size - record_header_size) {
+                throw invalid();
+            }
+            m_counts = data + record_header_size;
+            m_coordinates = m_counts + counts_size;
+            m_points_left = (size - record_header_size - counts_size) / (2 * sizeof(double));
+        }
+
+        uint32_t next_count() {
+            if (m_next_count >= m_count_count) {
+                throw invalid();
+            }
+            uint32_t count;
+            memcpy(&count, m_counts + sizeof(uint32_t) * m_next_count++, sizeof(count));
+            return count;
+        }
+
+        void read_point(bpoint_t& point) {
+            if (m_points_left == 0) {
+                throw invalid();
+            }
+            double xy[2];
+            memcpy(xy, m_coordinates, sizeof(xy));
+            m_coordinates += sizeof(xy);
+            --m_points_left;
+            point.x(xy[0]);
+            point.y(xy[1]);
+        }
+
+        template <typename TRange>
+        void read_points(TRange& points) {
+            const uint32_t count = next_count();
+            if (count > m_points_left) {
+                throw invalid();
+            }
+            points.resize(count);
+            for (bpoint_t& point : points) {
+                read_point(point);
+            }
+        }
+
+        void read_polygon(bpolygon_t& polygon) {
+            const uint32_t rings = next_count();
+            if (rings == 0) {
+                return;
+            }
+            read_points(polygon.outer());
+            polygon.inners().resize(rings - 1);
+            for (auto& inner : polygon.inners()) {
+                read_points(inner);
+            }
+        }
+    };
+
+} // anonymous namespace
+
+/*static*/ std::string GeometryCache::key(const std::string& dataset_path, const size_t layer,
+        const std::string& layer_name) {
+    char resolved[PATH_MAX];
+    struct stat st;
+    if (!realpath(dataset_path.c_str(), resolved) || stat(resolved, &st) != 0) {
+        throw std::runtime_error{"Failed to access " + dataset_path + ": " + strerror(errno)};
+    }
+    return std::string{resolved} + '\n' + std::to_string(st.st_size) + '\n' + std::to_string(st.st_mtim.tv_sec)
+        + '.' + std::to_string(st.st_mtim.tv_nsec) + '\n' + std::to_string(layer) + '\n' + layer_name;
+}
+
+/*static*/ std::string GeometryCache::path(const std::string& directory, const std::string& key) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (const char c : key) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%016lx.geom", static_cast<unsigned long>(hash));
+    return directory + "/" + name;
+}
+
+/*static*/ std::unique_ptr<GeometryCache> GeometryCache::open(const std::string& path, const std::string& key) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < magic_size + trailer_size + key.size()) {
+        close(fd);
+        return nullptr;
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+    std::unique_ptr<GeometryCache> cache {new GeometryCache{}};
+    cache->m_data = static_cast<const unsigned char*>(data);
+    cache->m_size = size;
+    const unsigned char* trailer = cache->m_data + size - trailer_size;
+    const uint64_t key_size = read_uint64(trailer);
+    cache->m_count = read_uint64(trailer + sizeof(uint64_t));
+    cache->m_index = read_uint64(trailer + 2 * sizeof(uint64_t));
+    const size_t index_end = size - trailer_size - key.size();
+    if (memcmp(cache->m_data, header_magic, magic_size) != 0
+            || memcmp(trailer + 3 * sizeof(uint64_t), trailer_magic, magic_size) != 0
+            || key_size != key.size() || memcmp(cache->m_data + index_end, key.data(), key.size()) != 0
+            || cache->m_index % 8 != 0 || cache->m_index > index_end
+            || cache->m_count != (index_end - cache->m_index) / entry_size
+            || (index_end - cache->m_index) % entry_size != 0) {
+        return nullptr;
+    }
+    // The features are read in the order of the file.
+    posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+    return cache;
+}
+
+GeometryCache::~GeometryCache() {
+    if (m_data) {
+        munmap(const_cast<unsigned char*>(m_data), m_size);
+    }
+}
+
+GeometryCache::Entry GeometryCache::entry(const uint64_t i) const {
+    Entry entry;
+    memcpy(&entry, m_data + m_index + i * entry_size, entry_size);
+    return entry;
+}
+
+void GeometryCache::read(const Entry& entry, bgeometry_t& geometry) const {
+    if (entry.offset < magic_size || entry.offset >= m_index) {
+        throw std::runtime_error{"Invalid record in geometry cache"};
+    }
+    uint32_t type;
+    RecordReader reader {m_data + entry.offset, m_index - entry.offset, type};
+    switch (type) {
+    case 0: {
+        bpoint_t point;
+        reader.read_point(point);
+        geometry = point;
+        break;
+    }
+    case 1: {
+        bmulti_point_t multi_point;
+        reader.read_points(multi_point);
+        geometry = std::move(multi_point);
+        break;
+    }
+    case 2: {
+        blinestring_t linestring;
+        reader.read_points(linestring);
+        geometry = std::move(linestring);
+        break;
+    }
+    case 3: {
+        bmulti_linestring_t multi_linestring;
+        multi_linestring.resize(reader.next_count());
+        for (blinestring_t& linestring : multi_linestring) {
+            reader.read_points(linestring);
+        }
+        geometry = std::move(multi_linestring);
+        break;
+    }
+    case 4: {
+        bpolygon_t polygon;
+        reader.read_polygon(polygon);
+        geometry = std::move(polygon);
+        break;
+    }
+    case 5: {
+        bmulti_polygon_t multi_polygon;
+        multi_polygon.resize(reader.next_count());
+        for (bpolygon_t& polygon : multi_polygon) {
+            reader.read_polygon(polygon);
+        }
+        geometry = std::move(multi_polygon);
+        break;
+    }
+    default:
+        throw std::runtime_error{"Invalid geometry type in geometry cache"};
+    }
+}
+
+GeometryCacheWriter::GeometryCacheWriter(const std::string& path, const std::string& key) :
+    m_path(path),
+    m_tmp_path(path + ".tmp"),
+    m_file(nullptr),
+    m_key(key) {
+    const std::string directory = path.substr(0, path.rfind('/'));
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error{"Failed to create geometry cache directory " + directory + ": " + strerror(errno)};
+    }
+    m_file = fopen(m_tmp_path.c_str(), "wb");
+    if (!m_file) {
+        throw std::runtime_error{"Failed to open " + m_tmp_path + ": " + strerror(errno)};
+    }
+    write(header_magic, magic_size);
+}
+
+GeometryCacheWriter::~GeometryCacheWriter() {
+    if (m_file) {
+        fclose(m_file);
+        unlink(m_tmp_path.c_str());
+    }
+}
+
+void GeometryCacheWriter::write(const void* data, const size_t size) {
+    if (fwrite(data, 1, size, m_file) != size) {
+        throw std::runtime_error{"Failed to write " + m_tmp_path + ": " + strerror(errno)};
+    }
+    m_offset += size;
+}
+
+void GeometryCacheWriter::pad() {
+    constexpr char zeros[8] = {};
+    if (m_offset % 8 != 0) {
+        write(zeros, 8 - m_offset % 8);
+    }
+}
+
+template <typename TRange>
+void GeometryCacheWriter::add_points(const TRange& points) {
+    m_counts.push_back(static_cast<uint32_t>(points.size()));
+    for (const bpoint_t& point : points) {
+        m_coordinates.push_back(point.x());
+        m_coordinates.push_back(point.y());
+    }
+}
+
+void GeometryCacheWriter::add_polygon(const bpolygon_t& polygon) {
+    if (polygon.outer().empty() && polygon.inners().empty()) {
+        m_counts.push_back(0);
+        return;
+    }
+    m_counts.push_back(static_cast<uint32_t>(polygon.inners().size() + 1));
+    add_points(polygon.outer());
+    for (const auto& inner : polygon.inners()) {
+        add_points(inner);
+    }
+}
+
+void GeometryCacheWriter::add(const bgeometry_t& geometry) {
+    m_counts.clear();
+    m_coordinates.clear();
+    switch (geometry.index()) {
+    case 0: {
+        const bpoint_t& point = std::get<bpoint_t>(geometry);
+        m_coordinates.push_back(point.x());
+        m_coordinates.push_back(point.y());
+        break;
+    }
+    case 1:
+        add_points(std::get<bmulti_point_t>(geometry));
+        break;
+    case 2:
+        add_points(std::get<blinestring_t>(geometry));
+        break;
+    case 3: {
+        const bmulti_linestring_t& multi_linestring = std::get<bmulti_linestring_t>(geometry);
+        m_counts.push_back(static_cast<uint32_t>(multi_linestring.size()));
+        for (const blinestring_t& linestring : multi_linestring) {
+            add_points(linestring);
+        }
+        break;
+    }
+    case 4:
+        add_polygon(std::get<bpolygon_t>(geometry));
+        break;
+    case 5: {
+        const bmulti_polygon_t& multi_polygon = std::get<bmulti_polygon_t>(geometry);
+        m_counts.push_back(static_cast<uint32_t>(multi_polygon.size()));
+        for (const bpolygon_t& polygon : multi_polygon) {
+            add_polygon(polygon);
+        }
+        break;
+    }
+    }
+    // The envelope of an empty geometry is inverted.
+    GeometryCache::Entry entry {std::numeric_limits<double>::max(), std::numeric_limits<double>::max(),
+        std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), m_offset};
+    for (size_t i = 0; i < m_coordinates.size(); i += 2) {
+        entry.min_x = std::min(entry.min_x, m_coordinates[i]);
+        entry.min_y = std::min(entry.min_y, m_coordinates[i + 1]);
+        entry.max_x = std::max(entry.max_x, m_coordinates[i]);
+        entry.max_y = std::max(entry.max_y, m_coordinates[i + 1]);
+    }
+    m_index.push_back(entry);
+    const uint32_t header[2] = {static_cast<uint32_t>(geometry.index()), static_cast<uint32_t>(m_counts.size())};
+    write(header, sizeof(header));
+    write(m_counts.data(), m_counts.size() * sizeof(uint32_t));
+    pad();
+    write(m_coordinates.data(), m_coordinates.size() * sizeof(double));
+}
+
+void GeometryCacheWriter::commit() {
+    const uint64_t index_offset = m_offset;
+    write(m_index.data(), m_index.size() * entry_size);
+    write(m_key.data(), m_key.size());
+    const uint64_t trailer[3] = {m_key.size(), m_index.size(), index_offset};
+    write(trailer, sizeof(trailer));
+    write(trailer_magic, magic_size);
+    const bool ok = fflush(m_file) == 0;
+    fclose(m_file);
+    m_file = nullptr;
+    if (!ok || rename(m_tmp_path.c_str(), m_path.c_str()) != 0) {
+        unlink(m_tmp_path.c_str());
+        throw std::runtime_error{"Failed to write " + m_path + ": " + strerror(errno)};
+    }
+}
@@ -0,0 +1,172 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SRC_GEOMETRY_CACHE_HPP_
+#define SRC_GEOMETRY_CACHE_HPP_
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "geometry_types.hpp"
+
+/**
+ * On-disk cache of the geometries of a data layer after their transformation to Web Mercator
+ * and conversion to Boost Geometry.
+ *
+ * A cache file belongs to one layer of a dataset. It is identified by a key containing the
+ * path, size and modification time of the dataset and the layer, see key(). The file consists
+ * of the feature records, followed by an index with the envelope and the offset of each record
+ * and a trailer. A record starts with the geometry type and the number of counts following it;
+ * the counts describe the structure (e.g. number of rings and their number of points) and are
+ * followed by the coordinates. Records are aligned to 8 bytes, therefore the file can be used
+ * directly after mapping it into memory.
+ */
+class GeometryCache {
+
+public:
+    /**
+     * Envelope and offset of a feature record
+     */
+    struct Entry {
+        double min_x;
+        double min_y;
+        double max_x;
+        double max_y;
+        uint64_t offset;
+    };
+
+private:
+    const unsigned char* m_data = nullptr;
+
+    size_t m_size = 0;
+
+    /// position of the index
+    size_t m_index = 0;
+
+    uint64_t m_count = 0;
+
+    GeometryCache() = default;
+
+public:
+    /**
+     * Build the key of a layer of a dataset.
+     *
+     * \throws std::runtime_error if the dataset cannot be accessed
+     */
+    static std::string key(const std::string& dataset_path, const size_t layer, const std::string& layer_name);
+
+    /**
+     * Get the path of the cache file of a key in a directory.
+     */
+    static std::string path(const std::string& directory, const std::string& key);
+
+    /**
+     * Open and map a cache file.
+     *
+     * \returns nullptr if the file does not exist, is incomplete or belongs to another key
+     */
+    static std::unique_ptr<GeometryCache> open(const std::string& path, const std::string& key);
+
+    GeometryCache(const GeometryCache&) = delete;
+
+    GeometryCache& operator=(const GeometryCache&) = delete;
+
+    ~GeometryCache();
+
+    /**
+     * Number of features in the cache
+     */
+    uint64_t size() const noexcept {
+        return m_count;
+    }
+
+    Entry entry(const uint64_t i) const;
+
+    /**
+     * Read the geometry of a feature.
+     *
+     * \throws std::runtime_error if the record is invalid
+     */
+    void read(const Entry& entry, bgeometry_t& geometry) const;
+};
+
+/**
+ * Writer of a cache file, see GeometryCache. The file is written under a temporary name and
+ * renamed when it is complete.
+ */
+class GeometryCacheWriter {
+
+    std::string m_path;
+
+    std::string m_tmp_path;
+
+    FILE* m_file;
+
+    std::string m_key;
+
+    /// number of bytes written so far
+    uint64_t m_offset = 0;
+
+    std::vector<GeometryCache::Entry> m_index;
+
+    /// counts and coordinates of the current record
+    std::vector<uint32_t> m_counts;
+    std::vector<double> m_coordinates;
+
+    void write(const void* data, const size_t size);
+
+    void pad();
+
+    template <typename TRange>
+    void add_points(const TRange& points);
+
+    void add_polygon(const bpolygon_t& polygon);
+
+public:
+    /**
+     * \param path path of the cache file, its directory is created if it does not exist
+     * \param key key of the layer, see GeometryCache::key()
+     *
+     * \throws std::runtime_error if the file cannot be created
+     */
+    GeometryCacheWriter(const std::string& path, const std::string& key);
+
+    GeometryCacheWriter(const GeometryCacheWriter&) = delete;
+
+    GeometryCacheWriter& operator=(const GeometryCacheWriter&) = delete;
+
+    /**
+     * Remove the temporary file if commit() has not been called.
+     */
+    ~GeometryCacheWriter();
+
+    /**
+     * Append the geometry of a feature.
+     *
+     * \throws std::runtime_error if writing fails
+     */
+    void add(const bgeometry_t& geometry);
+
+    /**
+     * Write the index and the trailer and move the file to its final name.
+     *
+     * \throws std::runtime_error if writing fails
+     */
+    void commit();
+};
+
+#endif /* SRC_GEOMETRY_CACHE_HPP_ */
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SRC_GEOMETRY_TYPES_HPP_
+#define SRC_GEOMETRY_TYPES_HPP_
+
+#include <variant>
+#include <boost/geometry/geometries/adapted/c_array.hpp>
+#include <boost/geometry/geometries/point_xy.hpp>
+#include <boost/geometry/geometries/multi_point.hpp>
+#include <boost/geometry/geometries/linestring.hpp>
+#include <boost/geometry/geometries/multi_linestring.hpp>
+#include <boost/geometry/geometries/polygon.hpp>
+#include <boost/geometry/geometries/multi_polygon.hpp>
+#include <boost/geometry/geometries/box.hpp>
+#include <boost/geometry/geometries/segment.hpp>
+
+namespace bgeom = boost::geometry;
+BOOST_GEOMETRY_REGISTER_C_ARRAY_CS(bgeom::cs::cartesian)
+using geometry_numeric_type = double;
+using bpoint_t = bgeom::model::d2::point_xy<geometry_numeric_type>;
+using bmulti_point_t = bgeom::model::multi_point<bpoint_t>;
+using blinestring_t = bgeom::model::linestring<bpoint_t>;
+using bmulti_linestring_t = bgeom::model::multi_linestring<blinestring_t>;
+using bpolygon_t = bgeom::model::polygon<bpoint_t>;
+using bmulti_polygon_t = bgeom::model::multi_polygon<bpolygon_t>;
+using box_t = bgeom::model::box<bpoint_t>;
+using bgeometry_t = std::variant<bpoint_t, bmulti_point_t, blinestring_t, bmulti_linestring_t, bpolygon_t, bmulti_polygon_t>;
+using bsegment_t = bgeom::model::segment<bpoint_t>;
+
+#endif /* SRC_GEOMETRY_TYPES_HPP_ */
@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+
+#include "mbtiles_index.hpp"
+#include "tile_list.hpp"
+#include <sqlite3.h>
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+    /**
+     * Open an MBTiles file and prepare the query of the rows of a column of tiles.
+     */
+    void open_tiles_query(const std::string& path, sqlite3*& db, sqlite3_stmt*& stmt) {
+        if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+            std::string message = db ? sqlite3_errmsg(db) : "out of memory";
+            sqlite3_close(db);
+            db = nullptr;
+            throw std::runtime_error{"Failed to open MBTiles file " + path + ": " + message};
+        }
+        // This query is answered by a range scan on the unique index on zoom_level, tile_column and tile_row.
+        const char* sql = "SELECT tile_row FROM tiles WHERE zoom_level = ?1 AND tile_column = ?2 " \
+            "AND tile_row BETWEEN ?3 AND ?4";
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+            std::string message = sqlite3_errmsg(db);
+            sqlite3_close(db);
+            db = nullptr;
+            throw std::runtime_error{"Failed to query tiles table of " + path + ": " + message};
+        }
+    }
+
+} // anonymous namespace
+
+MBTilesIndex::MBTilesIndex(const std::string& path) :
+    m_path(path) {
+    // Fail early if the file cannot be read, not when the first tile is looked up.
+    Cursor check {*this};
+}
+
+MBTilesIndex::Cursor::Cursor(const MBTilesIndex& index) :
+    m_path(index.m_path) {
+    open_tiles_query(m_path, m_db, m_stmt);
+}
+
+MBTilesIndex::Cursor::~Cursor() {
+    sqlite3_finalize(m_stmt);
+    sqlite3_close(m_db);
+}
+
+void MBTilesIndex::Cursor::load_column(const uint32_t zoom, const uint32_t x, const uint32_t row_min,
+        const uint32_t row_max, std::vector<uint32_t>& rows) {
+    sqlite3_reset(m_stmt);
+    sqlite3_bind_int64(m_stmt, 1, zoom);
+    sqlite3_bind_int64(m_stmt, 2, x);
+    sqlite3_bind_int64(m_stmt, 3, row_min);
+    sqlite3_bind_int64(m_stmt, 4, row_max);
+    int rc;
+    while ((rc = sqlite3_step(m_stmt)) == SQLITE_ROW) {
+        rows.push_back(static_cast<uint32_t>(sqlite3_column_int64(m_stmt, 0)));
+    }
+    if (rc != SQLITE_DONE) {
+        throw std::runtime_error{"Failed to read tiles table of " + m_path + ": " + sqlite3_errmsg(m_db)};
+    }
+    // The rows are returned in the order of the index, this is just a safeguard.
+    if (!std::is_sorted(rows.begin(), rows.end())) {
+        std::sort(rows.begin(), rows.end());
+    }
+}
+
+bool MBTilesIndex::Cursor::contains(const uint32_t zoom, const uint64_t quadkey) {
+    if (m_blocks.size() <= zoom) {
+        m_blocks.resize(zoom + 1);
+    }
+    Block& block = m_blocks[zoom];
+    const uint32_t bits = std::min(zoom, block_bits);
+    const uint64_t block_quadkey = quadkey >> (2 * bits);
+    if (block.quadkey != block_quadkey) {
+        // Only the columns read are cleared, their memory is reused.
+        for (const uint32_t column : block.loaded_columns) {
+            block.columns[column].clear();
+            block.loaded[column] = false;
+        }
+        block.loaded_columns.clear();
+        block.columns.resize(1u << bits);
+        block.loaded.resize(1u << bits);
+        block.quadkey = block_quadkey;
+    }
+    const xy_coord_t xy = TileList::quadkey_to_xy(quadkey, zoom);
+    // MBTiles uses the TMS scheme, i.e. the y axis is flipped.
+    const uint32_t max_row = static_cast<uint32_t>((1ULL << zoom) - 1);
+    const uint32_t column = xy.x & ((1u << bits) - 1);
+    std::vector<uint32_t>& rows = block.columns[column];
+    if (!block.loaded[column]) {
+        const uint32_t ymin = (xy.y >> bits) << bits;
+        const uint32_t ymax = ymin + ((1u << bits) - 1);
+        load_column(zoom, xy.x, max_row - ymax, max_row - ymin, rows);
+        block.loaded[column] = true;
+        block.loaded_columns.push_back(column);
+    }
+    return std::binary_search(rows.begin(), rows.end(), max_row - xy.y);
+}
@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SRC_MBTILES_INDEX_HPP_
+#define SRC_MBTILES_INDEX_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+/**
+ * Tiles present in an MBTiles file.
+ *
+ * Tiles are looked up using a Cursor which reads the index of the tiles table lazily while the
+ * lookups advance. Instead of querying the database once per tile, it reads the rows of a column
+ * of a block of tiles at once, i.e. one column and up to 1024 rows.
+ */
+class MBTilesIndex {
+
+    std::string m_path;
+
+public:
+    /**
+     * Open an MBTiles file for reading.
+     *
+     * \throws std::runtime_error if the file cannot be opened or has no tiles table
+     */
+    explicit MBTilesIndex(const std::string& path);
+
+    /**
+     * Lookup of tiles in the MBTiles file.
+     *
+     * The tiles are read per zoom level in blocks of block_bits × block_bits tiles aligned to
+     * the quadtree, i.e. consecutive quadkeys. For the current block of each zoom level, the
+     * columns looked up so far are kept in memory, every column is read by one range query on
+     * the index of the tiles table. Lookups in ascending order of the quadkeys or column by
+     * column read every column of a block once. The memory needed does not depend on the size
+     * of the file.
+     *
+     * Every cursor has its own database connection and can be used by another thread.
+     */
+    class Cursor {
+
+        /// tiles of the current block of a zoom level
+        struct Block {
+            /// quadkey of the block, ~0 if no block is loaded
+            uint64_t quadkey = ~uint64_t{0};
+            /// rows (TMS scheme) of the columns of the block in ascending order
+            std::vector<std::vector<uint32_t>> columns;
+            /// columns which have been read
+            std::vector<bool> loaded;
+            /// indexes of the columns which have been read
+            std::vector<uint32_t> loaded_columns;
+        };
+
+        const std::string& m_path;
+
+        sqlite3* m_db = nullptr;
+
+        sqlite3_stmt* m_stmt = nullptr;
+
+        std::vector<Block> m_blocks;
+
+        /**
+         * Read the rows of a column of the current block of a zoom level.
+         */
+        void load_column(const uint32_t zoom, const uint32_t x, const uint32_t row_min, const uint32_t row_max,
+                std::vector<uint32_t>& rows);
+
+    public:
+        /// a block spans 2^block_bits tiles in both directions
+        static constexpr uint32_t block_bits = 10;
+
+        /**
+         * \throws std::runtime_error if the file cannot be opened or has no tiles table
+         */
+        explicit Cursor(const MBTilesIndex& index);
+
+        Cursor(const Cursor&) = delete;
+
+        Cursor& operator=(const Cursor&) = delete;
+
+        ~Cursor();
+
+        /**
+         * Check if a tile exists in the MBTiles file.
+         *
+         * \param zoom zoom level of the tile
+         * \param quadkey quadkey of the tile
+         * \throws std::runtime_error if the query fails
+         */
+        bool contains(const uint32_t zoom, const uint64_t quadkey);
+    };
+
+    Cursor cursor() const {
+        return Cursor{*this};
+    }
+};
+
+#endif /* SRC_MBTILES_INDEX_HPP_ */
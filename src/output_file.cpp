@@ -0,0 +1,232 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "output_file.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdarg>
+#include <cstring>
+#include <stdexcept>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+OutputFile::OutputFile(const std::string& path, const Compression compression, const unsigned threads) :
+    m_file(nullptr),
+    m_owned(true),
+    m_compression(compression),
+    m_buffer(buffer_size) {
+    // check the compression before creating the file
+    if (compression == Compression::zstd && !zstd_available()) {
+        throw std::runtime_error{"zstd compression is not supported by this build"};
+    }
+    m_file = fopen(path.c_str(), "wb");
+    if (!m_file) {
+        throw std::runtime_error{"Failed to open output file " + path + ": " + strerror(errno)};
+    }
+    init(threads);
+}
+
+OutputFile::OutputFile(FILE* file, const Compression compression, const unsigned threads) :
+    m_file(file),
+    m_owned(false),
+    m_compression(compression),
+    m_buffer(buffer_size) {
+    init(threads);
+}
+
+OutputFile::~OutputFile() {
+    if (!m_closed) {
+        try {
+            close();
+        } catch (std::runtime_error&) {
+        }
+    }
+    if (m_gzip) {
+        deflateEnd(m_gzip.get());
+    }
+#ifdef HAVE_ZSTD
+    ZSTD_freeCCtx(m_zstd);
+#endif
+}
+
+void OutputFile::init(const unsigned threads) {
+    switch (m_compression) {
+    case Compression::none:
+        break;
+    case Compression::gzip:
+        m_compressed.resize(buffer_size);
+        m_gzip.reset(new z_stream_s{});
+        // window bits + 16 selects the gzip format
+        if (deflateInit2(m_gzip.get(), Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            m_gzip.reset();
+            throw std::runtime_error{"Failed to initialize gzip compression"};
+        }
+        break;
+    case Compression::zstd:
+#ifdef HAVE_ZSTD
+        m_compressed.resize(ZSTD_CStreamOutSize());
+        m_zstd = ZSTD_createCCtx();
+        if (!m_zstd) {
+            throw std::runtime_error{"Failed to initialize zstd compression"};
+        }
+        if (threads > 1) {
+            // fails if libzstd was built without multi-threading support, compress on this thread then
+            ZSTD_CCtx_setParameter(m_zstd, ZSTD_c_nbWorkers, static_cast<int>(threads));
+        }
+#else
+        (void) threads;
+        throw std::runtime_error{"zstd compression is not supported by this build"};
+#endif
+        break;
+    }
+}
+
+/*static*/ OutputFile::Compression OutputFile::compression_from_name(const std::string& name) {
+    if (name == "none") {
+        return Compression::none;
+    }
+    if (name == "gzip" || name == "gz") {
+        return Compression::gzip;
+    }
+    if (name == "zstd" || name == "zst") {
+        return Compression::zstd;
+    }
+    throw std::runtime_error{"Unknown compression " + name + ", use none, gzip or zstd"};
+}
+
+/*static*/ OutputFile::Compression OutputFile::compression_from_path(const std::string& path) {
+    auto ends_with = [&path](const std::string& suffix) {
+        return path.size() >= suffix.size() && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0;
+    };
+    if (ends_with(".gz")) {
+        return Compression::gzip;
+    }
+    if (ends_with(".zst")) {
+        return Compression::zstd;
+    }
+    return Compression::none;
+}
+
+/*static*/ bool OutputFile::zstd_available() {
+#ifdef HAVE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+void OutputFile::write_raw(const char* data, const size_t size) {
+    if (size > 0 && fwrite(data, 1, size, m_file) != size) {
+        throw std::runtime_error{std::string{"Failed to write output: "} + strerror(errno)};
+    }
+}
+
+void OutputFile::compress_gzip(const bool finish) {
+    m_gzip->next_in = reinterpret_cast<Bytef*>(m_buffer.data());
+    m_gzip->avail_in = static_cast<uInt>(m_used);
+    int rc;
+    do {
+        m_gzip->next_out = reinterpret_cast<Bytef*>(m_compressed.data());
+        m_gzip->avail_out = static_cast<uInt>(m_compressed.size());
+        rc = deflate(m_gzip.get(), finish ? Z_FINISH : Z_NO_FLUSH);
+        if (rc == Z_STREAM_ERROR) {
+            throw std::runtime_error{"gzip compression failed"};
+        }
+        write_raw(m_compressed.data(), m_compressed.size() - m_gzip->avail_out);
+    } while (m_gzip->avail_out == 0 || (finish && rc != Z_STREAM_END));
+}
+
+void OutputFile::compress_zstd(const bool finish) {
+#ifdef HAVE_ZSTD
+    ZSTD_inBuffer input {m_buffer.data(), m_used, 0};
+    const ZSTD_EndDirective mode = finish ? ZSTD_e_end : ZSTD_e_continue;
+    bool done;
+    do {
+        ZSTD_outBuffer output {m_compressed.data(), m_compressed.size(), 0};
+        const size_t remaining = ZSTD_compressStream2(m_zstd, &output, &input, mode);
+        if (ZSTD_isError(remaining)) {
+            throw std::runtime_error{std::string{"zstd compression failed: "} + ZSTD_getErrorName(remaining)};
+        }
+        write_raw(m_compressed.data(), output.pos);
+        done = finish ? (remaining == 0) : (input.pos == input.size);
+    } while (!done);
+#else
+    (void) finish;
+#endif
+}
+
+void OutputFile::flush_buffer(const bool finish) {
+    switch (m_compression) {
+    case Compression::none:
+        write_raw(m_buffer.data(), m_used);
+        break;
+    case Compression::gzip:
+        compress_gzip(finish);
+        break;
+    case Compression::zstd:
+        compress_zstd(finish);
+        break;
+    }
+    m_used = 0;
+}
+
+void OutputFile::write(const char* data, size_t size) {
+    while (size > 0) {
+        if (m_used == m_buffer.size()) {
+            flush_buffer(false);
+        }
+        const size_t count = std::min(size, m_buffer.size() - m_used);
+        memcpy(m_buffer.data() + m_used, data, count);
+        m_used += count;
+        data += count;
+        size -= count;
+    }
+}
+
+void OutputFile::print(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    va_list args_copy;
+    va_copy(args_copy, args);
+    const int length = vsnprintf(m_buffer.data() + m_used, m_buffer.size() - m_used, format, args);
+    va_end(args);
+    if (length < 0) {
+        va_end(args_copy);
+        throw std::runtime_error{"Failed to format output"};
+    }
+    if (static_cast<size_t>(length) < m_buffer.size() - m_used) {
+        m_used += length;
+    } else {
+        // did not fit into the rest of the buffer
+        std::vector<char> text(length + 1);
+        vsnprintf(text.data(), text.size(), format, args_copy);
+        write(text.data(), length);
+    }
+    va_end(args_copy);
+}
+
+void OutputFile::close() {
+    m_closed = true;
+    flush_buffer(true);
+    if (m_owned) {
+        if (fclose(m_file) != 0) {
+            throw std::runtime_error{"closing output file failed"};
+        }
+    } else if (fflush(m_file) != 0) {
+        throw std::runtime_error{"flushing output failed"};
+    }
+}
@@ -0,0 +1,138 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SRC_OUTPUT_FILE_HPP_
+#define SRC_OUTPUT_FILE_HPP_
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct z_stream_s;
+struct ZSTD_CCtx_s;
+
+/**
+ * Buffered output which is optionally compressed using gzip or zstd.
+ *
+ * The output is collected in a buffer. If the buffer is full, it is compressed as a
+ * whole and written to the file. zstd compresses using multiple threads if requested.
+ */
+class OutputFile {
+
+public:
+    enum class Compression {
+        none,
+        gzip,
+        zstd
+    };
+
+private:
+    static constexpr size_t buffer_size = 1 << 20;
+
+    FILE* m_file;
+
+    /// close m_file when done
+    bool m_owned;
+
+    Compression m_compression;
+
+    /// uncompressed data which has not been written yet
+    std::vector<char> m_buffer;
+    size_t m_used = 0;
+
+    /// output buffer of the compressor
+    std::vector<char> m_compressed;
+
+    std::unique_ptr<z_stream_s> m_gzip;
+
+    ZSTD_CCtx_s* m_zstd = nullptr;
+
+    bool m_closed = false;
+
+    void init(unsigned threads);
+
+    void write_raw(const char* data, const size_t size);
+
+    /**
+     * Compress and write the buffer.
+     *
+     * \param finish end the compressed stream
+     */
+    void flush_buffer(const bool finish);
+
+    void compress_gzip(const bool finish);
+
+    void compress_zstd(const bool finish);
+
+public:
+    /**
+     * Open a file for writing.
+     *
+     * \param threads number of threads for compression, only used by zstd
+     *
+     * \throws std::runtime_error if the file cannot be opened or the compression is not supported
+     */
+    OutputFile(const std::string& path, const Compression compression, const unsigned threads = 1);
+
+    /**
+     * Write to an already opened file, e.g. stdout. The file is not closed by close().
+     *
+     * \throws std::runtime_error if the compression is not supported
+     */
+    OutputFile(FILE* file, const Compression compression, const unsigned threads = 1);
+
+    OutputFile(const OutputFile&) = delete;
+
+    OutputFile& operator=(const OutputFile&) = delete;
+
+    /**
+     * Calls close() if it was not called before. Errors are ignored.
+     */
+    ~OutputFile();
+
+    /**
+     * Get the compression by its name (none, gzip or zstd).
+     *
+     * \throws std::runtime_error if the name is unknown
+     */
+    static Compression compression_from_name(const std::string& name);
+
+    /**
+     * Get the compression from the suffix of a file name (.gz or .zst).
+     */
+    static Compression compression_from_path(const std::string& path);
+
+    /**
+     * Check if zstd support was compiled in.
+     */
+    static bool zstd_available();
+
+    void write(const char* data, const size_t size);
+
+    /**
+     * Format like printf and write the result.
+     */
+    void print(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+    /**
+     * Finish the compressed stream, flush all data and close the file if it was opened by this instance.
+     *
+     * \throws std::runtime_error if writing fails
+     */
+    void close();
+};
+
+#endif /* SRC_OUTPUT_FILE_HPP_ */
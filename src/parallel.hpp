@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SRC_PARALLEL_HPP_
+#define SRC_PARALLEL_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Call func(i) for every i in [0, count) using up to the given number of threads.
+ *
+ * Work items are handed out one by one from a shared counter. A thread which finishes
+ * a cheap item takes the next one immediately, so items of very different cost are
+ * balanced across the threads. The calling thread works as well.
+ *
+ * If func throws, the remaining items are skipped and the first exception is rethrown
+ * in the calling thread.
+ */
+template <typename TFunction>
+void parallel_for(const size_t count, const unsigned threads, TFunction&& func) {
+    const size_t thread_count = std::min<size_t>(std::max(threads, 1u), count);
+    if (thread_count <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            func(i);
+        }
+        return;
+    }
+    std::atomic<size_t> next {0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next.fetch_add(1, std::memory_order_relaxed)) < count) {
+            try {
+                func(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock {error_mutex};
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next.store(count, std::memory_order_relaxed);
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(thread_count - 1);
+    for (size_t t = 1; t < thread_count; ++t) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& t : workers) {
+        t.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+#endif /* SRC_PARALLEL_HPP_ */
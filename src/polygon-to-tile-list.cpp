@@ -16,24 +16,67 @@
 #include <getopt.h>
 #include <string.h>
 #include <iostream>
+#include <stdexcept>
 #include <vector>
 
+#include "checkpoint.hpp"
 #include "gdal_intersecting_tiles_finder.hpp"
+#include "mbtiles_index.hpp"
+#include "output_file.hpp"
+#include "tile_estimate.hpp"
 #include "utils.hpp"
 
 
-void print_all_tiles_on_range(FILE* output_file, const uint32_t minzoom, const uint32_t maxzoom,
+void print_all_tiles_on_range(OutputFile& output_file, const uint32_t minzoom, const uint32_t maxzoom,
         const BoundingBox& bbox, const std::string& suffix, const char delimiter,
-        const bool check_exists, const std::string& path, bool tirex) {
+        const bool check_exists, const std::string& path, bool tirex, bool classify, MBTilesIndex* mbtiles,
+        Stats& stats) {
     for (uint32_t z = minzoom; z <= maxzoom; ++z) {
-        ZoomRange range = ZoomRange::from_bbox_geographic(bbox, z);
-        for (uint32_t x = range.xmin; x <= range.xmax; ++x) {
-            for (uint32_t y = range.ymin; y <= range.ymax; ++y) {
-                std::unique_ptr<char> tile_path = TileList::get_tile_path(path, z, x, y, suffix, tirex);
-                if (check_exists && !TileList::check_file_exists(tile_path.get())) {
-                    continue;
+        // columns of the western and eastern edge, xmin > xmax if the bounding box crosses the antimeridian
+        const ZoomRange edges = ZoomRange::from_bbox_geographic(bbox, z);
+        std::vector<ZoomRange> ranges;
+        for (const BoundingBox& part : bbox.split_at_antimeridian()) {
+            ranges.push_back(ZoomRange::from_bbox_geographic(part, z));
+        }
+        // Both parts of a bounding box crossing the antimeridian can share tiles at low zoom levels.
+        if (ranges.size() == 2 && ranges[0].xmax >= ranges[1].xmin) {
+            ranges[0].xmax = ranges[1].xmax;
+            ranges.pop_back();
+        }
+        for (const ZoomRange& range : ranges) {
+            std::unique_ptr<MBTilesIndex::Cursor> cursor;
+            if (check_exists && mbtiles) {
+                cursor.reset(new MBTilesIndex::Cursor{*mbtiles});
+            }
+            for (uint32_t x = range.xmin; x <= range.xmax; ++x) {
+                for (uint32_t y = range.ymin; y <= range.ymax; ++y) {
+                    if (cursor) {
+                        StageTimer timer {stats, Stage::check_exists};
+                        if (!cursor->contains(z, TileList::xy_to_quadkey(x, y, z))) {
+                            continue;
+                        }
+                    }
+                    std::unique_ptr<char[]> tile_path;
+                    {
+                        StageTimer timer {stats, Stage::format};
+                        tile_path = TileList::get_tile_path(path, z, x, y, suffix, tirex);
+                    }
+                    if (check_exists && !cursor) {
+                        StageTimer timer {stats, Stage::check_exists};
+                        if (!TileList::check_file_exists(tile_path.get())) {
+                            continue;
+                        }
+                    }
+                    StageTimer timer {stats, Stage::write};
+                    if (classify) {
+                        // Tiles at the edge of the range are only partially covered by the bounding box.
+                        bool full = x != edges.xmin && x != edges.xmax && y > range.ymin && y < range.ymax;
+                        output_file.print("%s %s%c", tile_path.get(), full ? "full" : "boundary", delimiter);
+                    } else {
+                        output_file.print("%s%c", tile_path.get(), delimiter);
+                    }
+                    stats.add_tiles_output(1);
                 }
-                fprintf(output_file, "%s%c", tile_path.get(), delimiter);
             }
         }
     }
@@ -45,17 +88,40 @@ void print_usage(char* argv[]) {
     "Options:\n" \
     "  -h, --help                  print help and exit\n" \
     "  -a STR, --append=STR        Print following string at the end of the output. The program will append newline character to the string\n" \
-    "  -b BBOX, --bbox=BBOX        bounding box separated by comma: min_lon,min_lat,max_lon,max_lat\n" \
+    "  -b BBOX, --bbox=BBOX        bounding box separated by comma: min_lon,min_lat,max_lon,max_lat,\n" \
+    "                              it crosses the antimeridian if min_lon > max_lon\n" \
+    "  --bbox-file=FILE            read bounding boxes from FILE, one per line in the format of --bbox,\n" \
+    "                              tiles covered by multiple bounding boxes are printed once\n" \
+    "  --checkpoint=DIR            save the progress to DIR at intervals and resume from it after a restart\n" \
+    "  --checkpoint-interval=SEC   seconds between two checkpoints, defaults to 300\n" \
     "  -c, --check-exists          Check if the tiles exist as files on the disk.\n" \
+    "  --check-mbtiles=FILE        Check if the tiles exist in an MBTiles file.\n" \
+    "  --classify                  Print 'full' or 'boundary' after each tile depending on whether it is completely covered\n" \
     "  -d DIR, --directory=DIR     Tile directory for --check-exists.\n" \
+    "  --estimate[=N]              print an estimate of the number of tiles per zoom level computed from a sample of\n" \
+    "                              N features per layer (defaults to 1000) instead of the tiles\n" \
+    "  --filter-bbox=BBOX          read only features of the geometry file intersecting BBOX\n" \
+    "  --fixed-point               use fixed-point tile coordinates for the index of large geometries\n" \
+    "  --index-threshold=N         build a spatial index of the edges of geometries with at least N vertices, 0 to disable, defaults to 1000\n" \
     "  -g PATH, --geom=PATH        Print all tiles intersecting with the (multi)linestrings and (multi)polygons in the specified file\n" \
+    "  --geometry-cache=DIR        cache the geometries of the geometry file projected to Web Mercator in DIR and\n" \
+    "                              read them from there in later runs\n" \
+    "  --max-tiles-per-feature=N   compute features with more than N tiles at the maximum zoom level at the deepest\n" \
+    "                              zoom level where they have at most N tiles and add all descendants of these tiles\n" \
+    "  --metatile[=MODE]           collapse tiles to 8x8 metatiles of mod_tile, MODE 'files' (default) prints the\n" \
+    "                              paths of the .meta files, 'tiles' prints tiles; --check-exists checks .meta files\n" \
     "  -n, --null                  Use NULL character, not LF as file delimiter.\n" \
+    "  --sort-features             process the features of the geometry file in the order of their position on the map\n" \
     "  -s SUFFIX, --suffix=SUFFIX  suffix to append (do not forget the leading dot)\n" \
+    "  -T N, --threads=N           number of threads, defaults to 1\n" \
     "  -t, --tirex                 tirex mode (different output style, only coords that are multiples of 8)\n" \
     "  -z ZOOM, --minzoom=ZOOM     minimum zoom level, defaults to 0\n" \
     "  -Z ZOOM, --maxzoom=ZOOM     maximum zoom level, defaults to 14\n" \
     "  --buffer-size=SIZE          buffer size in meter for lines and polygons (not bounding boxes)\n" \
     "  -o FILE, --output=FILE      write output to file instead of standard output\n" \
+    "  --compress=TYPE             compress output using TYPE (none, gzip, zstd), defaults to the\n" \
+    "                              suffix of the output file (.gz, .zst)\n" \
+    "  --stats=FILE                write timing and counters of all processing stages as JSON to FILE\n" \
     "  -v, --verbose               be verbose" << std::endl;
 }
 
@@ -63,15 +129,31 @@ int main(int argc, char* argv[]) {
     static struct option long_options[] = {
         {"append", required_argument, 0, 'a'},
         {"bbox", required_argument, 0, 'b'},
+        {"bbox-file", required_argument, 0, 'f'},
+        {"filter-bbox", required_argument, 0, 'r'},
+        {"fixed-point", no_argument, 0, 'F'},
         {"buffer-size", required_argument, 0, 'B'},
+        {"checkpoint", required_argument, 0, 'p'},
+        {"checkpoint-interval", required_argument, 0, 'i'},
         {"check.exists", required_argument, 0, 'c'},
+        {"check-mbtiles", required_argument, 0, 'M'},
+        {"classify", no_argument, 0, 'C'},
         {"directory", required_argument, 0, 'd'},
+        {"estimate", optional_argument, 0, 'E'},
         {"geom", required_argument, 0, 'g'},
+        {"geometry-cache", required_argument, 0, 'G'},
+        {"index-threshold", required_argument, 0, 'I'},
         {"minzoom", required_argument, 0, 'z'},
         {"maxzoom", required_argument, 0, 'Z'},
+        {"max-tiles-per-feature", required_argument, 0, 'x'},
+        {"metatile", optional_argument, 0, 'm'},
         {"null", no_argument, 0, 'n'},
         {"output", required_argument, 0, 'o'},
+        {"compress", required_argument, 0, 'k'},
+        {"sort-features", no_argument, 0, 'q'},
+        {"stats", required_argument, 0, 'S'},
         {"suffix", required_argument, 0, 's'},
+        {"threads", required_argument, 0, 'T'},
         {"tirex", no_argument, 0, 't'},
         {"help",  no_argument, 0, 'h'},
         {"verbose",  no_argument, 0, 'v'},
@@ -80,22 +162,39 @@ int main(int argc, char* argv[]) {
 
     bool verbose = false;
     bool tirex = false;
+    bool classify = false;
     char delimiter = '\n';
     int minzoom = 0;
     int maxzoom = 14;
     double buffer_size = 0.0;
+    long index_threshold = 1000;
+    int threads = 1;
     bool bbox_enabled = false;
     BoundingBox bbox {-180, -83, 180, 83};
     std::string shapefile_path;
+    std::string bbox_file;
+    bool fixed_point = false;
+    bool filter_enabled = false;
+    BoundingBox filter_bbox;
+    TileList::Metatiles metatiles = TileList::Metatiles::none;
+    std::string geometry_cache_dir;
+    long estimate_sample_size = 0;
+    long max_tiles_per_feature = 0;
+    bool sort_features = false;
+    std::string checkpoint_dir;
+    long checkpoint_interval = 300;
     bool check_exists = false;
     std::string check_dir;
-    FILE* output_file = stdout;
+    std::string mbtiles_path;
+    std::string output_path;
+    std::string compress_name;
     std::string suffix;
     std::string append_str;
+    std::string stats_path;
 
     char* rest;
     while (true) {
-        int c = getopt_long(argc, argv, "a:B:b:cd:g:nz:Z:o:s:vht", long_options, 0);
+        int c = getopt_long(argc, argv, "a:B:b:cCd:g:I:nz:Z:o:S:s:T:vht", long_options, 0);
         if (c == -1) {
             break;
         }
@@ -111,18 +210,85 @@ int main(int argc, char* argv[]) {
             bbox = BoundingBox::from_str(optarg);
             bbox_enabled = true;
             break;
+        case 'f':
+            bbox_file = optarg;
+            break;
+        case 'p':
+            checkpoint_dir = optarg;
+            break;
+        case 'i':
+            checkpoint_interval = atol(optarg);
+            if (checkpoint_interval < 1) {
+                std::cerr << "ERROR: Checkpoint interval must be at least 1 second.\n";
+                exit(1);
+            }
+            break;
+        case 'r':
+            filter_bbox = BoundingBox::from_str(optarg);
+            filter_enabled = true;
+            break;
+        case 'F':
+            fixed_point = true;
+            break;
         case 'c':
             check_exists = true;
             break;
+        case 'C':
+            classify = true;
+            break;
+        case 'M':
+            check_exists = true;
+            mbtiles_path = optarg;
+            break;
         case 'd':
             check_dir = optarg;
             break;
+        case 'E':
+            estimate_sample_size = optarg ? strtol(optarg, &rest, 10) : 1000;
+            if ((optarg && *rest != '\0') || estimate_sample_size < 1) {
+                std::cerr << "ERROR: Invalid sample size " << optarg << '\n';
+                exit(1);
+            }
+            break;
         case 'g':
             shapefile_path = optarg;
             break;
+        case 'G':
+            geometry_cache_dir = optarg;
+            break;
+        case 'I':
+            index_threshold = strtol(optarg, &rest, 10);
+            if (*rest != '\0' || index_threshold < 0) {
+                std::cerr << "ERROR: Invalid index threshold " << optarg << '\n';
+                exit(1);
+            }
+            break;
+        case 'x':
+            max_tiles_per_feature = strtol(optarg, &rest, 10);
+            if (*rest != '\0' || max_tiles_per_feature < 1) {
+                std::cerr << "ERROR: Invalid maximum number of tiles per feature " << optarg << '\n';
+                exit(1);
+            }
+            break;
+        case 'm':
+            if (!optarg || !strcmp(optarg, "files")) {
+                metatiles = TileList::Metatiles::files;
+            } else if (!strcmp(optarg, "tiles")) {
+                metatiles = TileList::Metatiles::tiles;
+            } else {
+                std::cerr << "ERROR: Unknown metatile mode " << optarg << ".\n";
+                exit(1);
+            }
+            break;
         case 'n':
             delimiter = '\0';
             break;
+        case 'q':
+            sort_features = true;
+            break;
+        case 'S':
+            stats_path = optarg;
+            break;
         case 's':
             suffix = optarg;
             if (suffix.empty()) {
@@ -139,11 +305,10 @@ int main(int argc, char* argv[]) {
             maxzoom = atoi(optarg);
             break;
         case 'o':
-            output_file = fopen(optarg, "w");
-            if (!output_file) {
-                std::cerr << "ERROR: Failed to open output file " << optarg << '\n';
-                exit(1);
-            }
+            output_path = optarg;
+            break;
+        case 'k':
+            compress_name = optarg;
             break;
         case 'h':
             print_usage(argv);
@@ -152,6 +317,13 @@ int main(int argc, char* argv[]) {
         case 't':
             tirex = true;
             break;
+        case 'T':
+            threads = atoi(optarg);
+            if (threads < 1) {
+                std::cerr << "ERROR: Number of threads must be at least 1.\n";
+                exit(1);
+            }
+            break;
         case 'v':
             verbose = true;
             break;
@@ -169,13 +341,34 @@ int main(int argc, char* argv[]) {
         exit(1);
     }
 
-    if (!bbox_enabled && shapefile_path.empty()) {
+    if (!bbox_enabled && bbox_file.empty() && shapefile_path.empty()) {
         std::cerr << "ERROR: Neither a bounding box nor a polygon was provided.\n";
         print_usage(argv);
         exit(1);
     }
 
-    if (check_exists && suffix.empty()) {
+    if (!mbtiles_path.empty() && tirex) {
+        std::cerr << "ERROR: --check-mbtiles cannot be used in tirex mode.\n";
+        exit(1);
+    }
+
+    if (metatiles != TileList::Metatiles::none && (tirex || !mbtiles_path.empty())) {
+        std::cerr << "ERROR: --metatile cannot be used together with --tirex or --check-mbtiles.\n";
+        exit(1);
+    }
+
+    if (estimate_sample_size > 0 && (shapefile_path.empty() || bbox_enabled || !bbox_file.empty() || tirex
+            || metatiles != TileList::Metatiles::none)) {
+        std::cerr << "ERROR: --estimate requires --geom and cannot be used with --bbox, --bbox-file, --tirex or --metatile.\n";
+        exit(1);
+    }
+
+    if (max_tiles_per_feature > 0 && !checkpoint_dir.empty()) {
+        std::cerr << "ERROR: --max-tiles-per-feature cannot be used together with --checkpoint.\n";
+        exit(1);
+    }
+
+    if (check_exists && suffix.empty() && mbtiles_path.empty()) {
         std::cerr << "WARNING: suffix is empty but checking tiles for existance is enabled.\n";
     }
 
@@ -184,25 +377,129 @@ int main(int argc, char* argv[]) {
         minzoom = (minzoom>3) ? minzoom -3 : 0;
     }
 
-    if (bbox_enabled) {
-        print_all_tiles_on_range(output_file, minzoom, maxzoom, bbox, suffix, delimiter, check_exists, check_dir, tirex);
+    Stats stats {!stats_path.empty()};
+
+    std::unique_ptr<OutputFile> output_file;
+    try {
+        OutputFile::Compression compression = OutputFile::Compression::none;
+        if (!compress_name.empty()) {
+            compression = OutputFile::compression_from_name(compress_name);
+        } else if (!output_path.empty()) {
+            compression = OutputFile::compression_from_path(output_path);
+        }
+        if (output_path.empty()) {
+            output_file.reset(new OutputFile{stdout, compression, static_cast<unsigned>(threads)});
+        } else {
+            output_file.reset(new OutputFile{output_path, compression, static_cast<unsigned>(threads)});
+        }
+    } catch (std::runtime_error& e) {
+        std::cerr << "ERROR: " << e.what() << '\n';
+        exit(1);
     }
 
-    if (!shapefile_path.empty()) {
-        GDALIntersectingTilesFinder finder {verbose, static_cast<uint32_t>(minzoom),
-            static_cast<uint32_t>(maxzoom), check_exists, tirex};
-        finder.find_intersections(shapefile_path, buffer_size);
-        if (verbose) {
-            std::cerr << "dumping tiles on medium zoom levels\n";
+    std::unique_ptr<MBTilesIndex> mbtiles;
+    if (!mbtiles_path.empty()) {
+        try {
+            mbtiles.reset(new MBTilesIndex{mbtiles_path});
+        } catch (std::runtime_error& e) {
+            std::cerr << "ERROR: " << e.what() << '\n';
+            exit(1);
         }
-        finder.output(output_file, suffix, delimiter, check_dir);
-    } // close scope to ensure that destructor of IntersectingTilesFinder is called now to free memory.
-    if (!append_str.empty()) {
-        fprintf(output_file, "%s%c", append_str.c_str(), delimiter);
     }
-    if (output_file != stdout) {
-        if (fclose(output_file) != 0) {
-            std::cerr << "ERROR: closing output file failed\n";
+
+    try {
+        // Bounding boxes from a file are added to a tile list to print every tile once.
+        std::vector<BoundingBox> bboxes;
+        if (!bbox_file.empty()) {
+            bboxes = BoundingBox::from_file(bbox_file);
+            if (bbox_enabled) {
+                bboxes.push_back(bbox);
+            }
+        } else if (bbox_enabled && metatiles != TileList::Metatiles::none) {
+            // The tile list collapses the tiles to metatiles.
+            bboxes.push_back(bbox);
+        } else if (bbox_enabled) {
+            print_all_tiles_on_range(*output_file, minzoom, maxzoom, bbox, suffix, delimiter, check_exists, check_dir, tirex, classify, mbtiles.get(), stats);
+        }
+        auto add_bboxes = [&bboxes, maxzoom](TileList& tile_list) {
+            for (const BoundingBox& b : bboxes) {
+                const std::vector<BoundingBox> parts = b.split_at_antimeridian();
+                for (size_t i = 0; i < parts.size(); ++i) {
+                    // The parts of a bounding box crossing the antimeridian continue on the other side of the map.
+                    const bool split = parts.size() == 2;
+                    tile_list.add_range(ZoomRange::from_bbox_geographic(parts[i], static_cast<uint32_t>(maxzoom)),
+                            split && i == 0, split && i == 1);
+                }
+            }
+        };
+
+        if (!shapefile_path.empty()) {
+            GDALIntersectingTilesFinder finder {verbose, static_cast<uint32_t>(minzoom),
+                static_cast<uint32_t>(maxzoom), check_exists, tirex, classify, stats};
+            finder.set_index_threshold(static_cast<size_t>(index_threshold));
+            finder.set_threads(static_cast<unsigned>(threads));
+            finder.set_fixed_point(fixed_point);
+            if (!geometry_cache_dir.empty()) {
+                finder.set_geometry_cache(geometry_cache_dir);
+            }
+            if (filter_enabled) {
+                finder.set_filter_bbox(filter_bbox);
+            }
+            finder.set_max_tiles_per_feature(static_cast<uint64_t>(max_tiles_per_feature));
+            finder.set_sort_features(sort_features);
+            if (estimate_sample_size > 0) {
+                TileEstimate estimate {static_cast<uint32_t>(minzoom), static_cast<uint32_t>(maxzoom)};
+                finder.estimate(shapefile_path, buffer_size, static_cast<uint64_t>(estimate_sample_size), estimate);
+                estimate.output(*output_file);
+            } else {
+                std::unique_ptr<Checkpoint> checkpoint;
+                if (!checkpoint_dir.empty()) {
+                    // The checkpoint is only valid for the same input and options affecting the tiles.
+                    std::string job = shapefile_path + " maxzoom=" + std::to_string(maxzoom) + " buffer="
+                        + std::to_string(buffer_size) + " classify=" + (classify ? "1" : "0")
+                        + " sort=" + (sort_features ? "1" : "0");
+                    if (filter_enabled) {
+                        job += " filter=" + std::to_string(filter_bbox.min_lon) + "," + std::to_string(filter_bbox.min_lat)
+                            + "," + std::to_string(filter_bbox.max_lon) + "," + std::to_string(filter_bbox.max_lat);
+                    }
+                    checkpoint.reset(new Checkpoint{checkpoint_dir, job, std::chrono::seconds{checkpoint_interval}});
+                    finder.set_checkpoint(checkpoint.get());
+                }
+                finder.tile_list().set_mbtiles(mbtiles.get());
+                finder.tile_list().set_metatiles(metatiles);
+                add_bboxes(finder.tile_list());
+                finder.find_intersections(shapefile_path, buffer_size);
+                if (verbose) {
+                    std::cerr << "dumping tiles on medium zoom levels\n";
+                }
+                finder.output(*output_file, suffix, delimiter, check_dir);
+            }
+        } else if (!bboxes.empty()) {
+            TileList tile_list {static_cast<uint32_t>(maxzoom), check_exists, tirex, classify, stats};
+            tile_list.set_mbtiles(mbtiles.get());
+            tile_list.set_metatiles(metatiles);
+            tile_list.set_threads(static_cast<unsigned>(threads));
+            add_bboxes(tile_list);
+            tile_list.output(*output_file, static_cast<uint32_t>(minzoom), suffix, delimiter, check_dir);
+        } // close scope to ensure that destructor of IntersectingTilesFinder is called now to free memory.
+    } catch (std::runtime_error& e) {
+        std::cerr << "ERROR: " << e.what() << '\n';
+        exit(1);
+    }
+    try {
+        if (!append_str.empty()) {
+            output_file->print("%s%c", append_str.c_str(), delimiter);
+        }
+        output_file->close();
+    } catch (std::runtime_error& e) {
+        std::cerr << "ERROR: " << e.what() << '\n';
+        exit(1);
+    }
+    if (stats.enabled()) {
+        try {
+            stats.write_json(stats_path);
+        } catch (std::runtime_error& e) {
+            std::cerr << "ERROR: " << e.what() << '\n';
             exit(1);
         }
     }
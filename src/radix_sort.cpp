@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "radix_sort.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <array>
+
+namespace {
+
+    constexpr unsigned digit_bits = 8;
+    constexpr size_t bucket_count = 1 << digit_bits;
+
+    /// inputs smaller than this are sorted using std::sort
+    constexpr size_t radix_min_size = 1 << 16;
+
+    /// minimum number of keys per thread
+    constexpr size_t chunk_min_size = 1 << 16;
+
+    using histogram_t = std::array<size_t, bucket_count>;
+
+} // anonymous namespace
+
+void radix_sort_unique(std::vector<uint64_t>& keys, const unsigned key_bits, const unsigned threads) {
+    const size_t size = keys.size();
+    if (size < radix_min_size) {
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        return;
+    }
+    const size_t chunks = std::max<size_t>(1, std::min<size_t>(std::max(threads, 1u), size / chunk_min_size));
+    const size_t chunk_size = (size + chunks - 1) / chunks;
+    std::vector<uint64_t> buffer(size);
+    std::vector<histogram_t> histograms(chunks);
+    uint64_t* src = keys.data();
+    uint64_t* dst = buffer.data();
+    for (unsigned shift = 0; shift < key_bits; shift += digit_bits) {
+        // count the digits of each chunk
+        parallel_for(chunks, threads, [&](const size_t c) {
+            histogram_t& histogram = histograms[c];
+            histogram.fill(0);
+            const size_t end = std::min(size, (c + 1) * chunk_size);
+            for (size_t i = c * chunk_size; i < end; ++i) {
+                ++histogram[(src[i] >> shift) & (bucket_count - 1)];
+            }
+        });
+        // Skip the pass if all keys have the same digit.
+        bool single_bucket = false;
+        for (size_t b = 0; b < bucket_count; ++b) {
+            size_t total = 0;
+            for (const histogram_t& histogram : histograms) {
+                total += histogram[b];
+            }
+            if (total == size) {
+                single_bucket = true;
+                break;
+            }
+            if (total > 0) {
+                break;
+            }
+        }
+        if (single_bucket) {
+            continue;
+        }
+        // Turn the counts into the start offsets of each chunk within each bucket.
+        size_t offset = 0;
+        for (size_t b = 0; b < bucket_count; ++b) {
+            for (histogram_t& histogram : histograms) {
+                const size_t count = histogram[b];
+                histogram[b] = offset;
+                offset += count;
+            }
+        }
+        // distribute, the order within each bucket is kept
+        parallel_for(chunks, threads, [&](const size_t c) {
+            histogram_t& positions = histograms[c];
+            const size_t end = std::min(size, (c + 1) * chunk_size);
+            for (size_t i = c * chunk_size; i < end; ++i) {
+                dst[positions[(src[i] >> shift) & (bucket_count - 1)]++] = src[i];
+            }
+        });
+        std::swap(src, dst);
+    }
+    if (src != keys.data()) {
+        keys.swap(buffer);
+    }
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SRC_RADIX_SORT_HPP_
+#define SRC_RADIX_SORT_HPP_
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Sort keys in ascending order and remove duplicates.
+ *
+ * Large inputs are sorted by a least significant digit radix sort with 8 bit digits.
+ * Only the digits within key_bits are sorted, and passes over digits which are equal for
+ * all keys are skipped. Each pass counts and distributes the keys of a chunk of the
+ * input per thread.
+ *
+ * \param keys keys to sort, all keys have to be smaller than 2^key_bits
+ * \param key_bits number of significant bits of the keys, e.g. 2 × zoom level for quadkeys
+ * \param threads number of threads
+ */
+void radix_sort_unique(std::vector<uint64_t>& keys, const unsigned key_bits, const unsigned threads = 1);
+
+#endif /* SRC_RADIX_SORT_HPP_ */
@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "segment_batch.hpp"
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SEGMENT_BATCH_AVX2
+#include <immintrin.h>
+#endif
+
+namespace {
+
+    constexpr double no_hit_lo = std::numeric_limits<double>::infinity();
+    constexpr double no_hit_hi = -std::numeric_limits<double>::infinity();
+
+    /**
+     * Clip segments [begin, end) to the x range [x0, x1] and store the y interval
+     * of the clipped segments. The interval is empty (ylo > yhi) if a segment is
+     * outside of the x range.
+     */
+    void clip_scalar(const size_t begin, const size_t end, const double* ax, const double* ay,
+            const double* bx, const double* by, const double x0, const double x1, double* ylo, double* yhi) {
+        for (size_t i = begin; i < end; ++i) {
+            const double minx = std::min(ax[i], bx[i]);
+            const double maxx = std::max(ax[i], bx[i]);
+            if (maxx < x0 || minx > x1) {
+                ylo[i] = no_hit_lo;
+                yhi[i] = no_hit_hi;
+                continue;
+            }
+            if (ax[i] == bx[i]) {
+                ylo[i] = std::min(ay[i], by[i]);
+                yhi[i] = std::max(ay[i], by[i]);
+                continue;
+            }
+            const double c0 = std::min(std::max(x0, minx), maxx);
+            const double c1 = std::max(std::min(x1, maxx), minx);
+            const double slope = (by[i] - ay[i]) / (bx[i] - ax[i]);
+            // Use the end point itself if it is inside the range to avoid rounding errors.
+            const double y0 = (c0 == bx[i]) ? by[i] : ay[i] + (c0 - ax[i]) * slope;
+            const double y1 = (c1 == bx[i]) ? by[i] : ay[i] + (c1 - ax[i]) * slope;
+            ylo[i] = std::min(y0, y1);
+            yhi[i] = std::max(y0, y1);
+        }
+    }
+
+#ifdef SEGMENT_BATCH_AVX2
+    /**
+     * Same as clip_scalar() for four segments at once. Remaining segments are clipped by clip_scalar().
+     */
+    __attribute__((target("avx2")))
+    void clip_avx2(const size_t count, const double* ax, const double* ay, const double* bx, const double* by,
+            const double x0, const double x1, double* ylo, double* yhi) {
+        const __m256d vx0 = _mm256_set1_pd(x0);
+        const __m256d vx1 = _mm256_set1_pd(x1);
+        const __m256d vno_lo = _mm256_set1_pd(no_hit_lo);
+        const __m256d vno_hi = _mm256_set1_pd(no_hit_hi);
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            const __m256d vax = _mm256_loadu_pd(ax + i);
+            const __m256d vay = _mm256_loadu_pd(ay + i);
+            const __m256d vbx = _mm256_loadu_pd(bx + i);
+            const __m256d vby = _mm256_loadu_pd(by + i);
+            const __m256d minx = _mm256_min_pd(vax, vbx);
+            const __m256d maxx = _mm256_max_pd(vax, vbx);
+            const __m256d outside = _mm256_or_pd(_mm256_cmp_pd(maxx, vx0, _CMP_LT_OQ),
+                    _mm256_cmp_pd(minx, vx1, _CMP_GT_OQ));
+            const __m256d vertical = _mm256_cmp_pd(vax, vbx, _CMP_EQ_OQ);
+            const __m256d c0 = _mm256_min_pd(_mm256_max_pd(vx0, minx), maxx);
+            const __m256d c1 = _mm256_max_pd(_mm256_min_pd(vx1, maxx), minx);
+            const __m256d slope = _mm256_div_pd(_mm256_sub_pd(vby, vay), _mm256_sub_pd(vbx, vax));
+            __m256d y0 = _mm256_add_pd(vay, _mm256_mul_pd(_mm256_sub_pd(c0, vax), slope));
+            __m256d y1 = _mm256_add_pd(vay, _mm256_mul_pd(_mm256_sub_pd(c1, vax), slope));
+            y0 = _mm256_blendv_pd(y0, vby, _mm256_cmp_pd(c0, vbx, _CMP_EQ_OQ));
+            y1 = _mm256_blendv_pd(y1, vby, _mm256_cmp_pd(c1, vbx, _CMP_EQ_OQ));
+            // vertical segments: the whole segment is inside the range
+            y0 = _mm256_blendv_pd(y0, vay, vertical);
+            y1 = _mm256_blendv_pd(y1, vby, vertical);
+            __m256d lo = _mm256_min_pd(y0, y1);
+            __m256d hi = _mm256_max_pd(y0, y1);
+            lo = _mm256_blendv_pd(lo, vno_lo, outside);
+            hi = _mm256_blendv_pd(hi, vno_hi, outside);
+            _mm256_storeu_pd(ylo + i, lo);
+            _mm256_storeu_pd(yhi + i, hi);
+        }
+        clip_scalar(i, count, ax, ay, bx, by, x0, x1, ylo, yhi);
+    }
+#endif
+
+} // anonymous namespace
+
+/*static*/ bool SegmentBatch::vectorized() {
+#ifdef SEGMENT_BATCH_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+#else
+    return false;
+#endif
+}
+
+/*static*/ void SegmentBatch::set_bits(std::vector<uint64_t>& bits, const size_t first, const size_t last) {
+    const size_t first_word = first / 64;
+    const size_t last_word = last / 64;
+    const uint64_t first_mask = ~uint64_t{0} << (first % 64);
+    const uint64_t last_mask = ~uint64_t{0} >> (63 - last % 64);
+    if (first_word == last_word) {
+        bits[first_word] |= first_mask & last_mask;
+        return;
+    }
+    bits[first_word] |= first_mask;
+    for (size_t w = first_word + 1; w < last_word; ++w) {
+        bits[w] = ~uint64_t{0};
+    }
+    bits[last_word] |= last_mask;
+}
+
+void SegmentBatch::clip(const double x0, const double x1) {
+    const size_t count = size();
+    m_ylo.resize(count);
+    m_yhi.resize(count);
+#ifdef SEGMENT_BATCH_AVX2
+    if (vectorized()) {
+        clip_avx2(count, m_ax.data(), m_ay.data(), m_bx.data(), m_by.data(), x0, x1, m_ylo.data(), m_yhi.data());
+        return;
+    }
+#endif
+    clip_scalar(0, count, m_ax.data(), m_ay.data(), m_bx.data(), m_by.data(), x0, x1, m_ylo.data(), m_yhi.data());
+}
+
+void SegmentBatch::mark_column(const double x0, const double x1, const std::vector<double>& row_edges,
+        std::vector<uint64_t>& hits) {
+    const size_t tile_count = row_edges.size() - 1;
+    hits.assign((tile_count + 63) / 64, 0);
+    if (tile_count == 0) {
+        return;
+    }
+    clip(x0, x1);
+    const auto edges_begin = row_edges.begin();
+    const auto edges_end = row_edges.end();
+    for (size_t i = 0; i < size(); ++i) {
+        const double ylo = m_ylo[i];
+        const double yhi = m_yhi[i];
+        if (ylo > yhi) {
+            continue;
+        }
+        // first tile whose lower edge is at or below yhi
+        const size_t first = std::lower_bound(edges_begin + 1, edges_end, yhi, std::greater<double>()) - (edges_begin + 1);
+        // first tile whose upper edge is below ylo, i.e. one behind the last intersecting tile
+        const size_t end = std::upper_bound(edges_begin, edges_end - 1, ylo, std::greater<double>()) - edges_begin;
+        if (first < end) {
+            set_bits(hits, first, end - 1);
+        }
+    }
+}
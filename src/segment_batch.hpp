@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SRC_SEGMENT_BATCH_HPP_
+#define SRC_SEGMENT_BATCH_HPP_
+
+#include <cstdint>
+#include <vector>
+#include "geometry_types.hpp"
+
+/**
+ * Segments stored as separate arrays of their coordinates (structure of arrays).
+ *
+ * A batch is tested against a column of tiles at once: Each segment is clipped to the
+ * x range of the column and the tiles between the lowest and the highest y coordinate
+ * of the clipped segment are marked in a bitmask. Clipping is done for four segments
+ * at once using AVX2 if the CPU supports it.
+ */
+class SegmentBatch {
+
+    std::vector<double> m_ax;
+    std::vector<double> m_ay;
+    std::vector<double> m_bx;
+    std::vector<double> m_by;
+
+    /// y interval of the clipped segments, filled by clip()
+    std::vector<double> m_ylo;
+    std::vector<double> m_yhi;
+
+    void clip(const double x0, const double x1);
+
+public:
+    void clear() noexcept {
+        m_ax.clear();
+        m_ay.clear();
+        m_bx.clear();
+        m_by.clear();
+    }
+
+    size_t size() const noexcept {
+        return m_ax.size();
+    }
+
+    void add(const bsegment_t& segment) {
+        m_ax.push_back(segment.first.x());
+        m_ay.push_back(segment.first.y());
+        m_bx.push_back(segment.second.x());
+        m_by.push_back(segment.second.y());
+    }
+
+    /**
+     * Mark all tiles of a column which are intersected by any segment of the batch.
+     * Tiles are closed boxes, i.e. touching the boundary of a tile counts as intersection.
+     *
+     * \param x0 minimum x coordinate of the column
+     * \param x1 maximum x coordinate of the column
+     * \param row_edges y coordinates of the edges between the tiles of the column in
+     *        descending order, i.e. tile i spans from row_edges[i + 1] to row_edges[i].
+     *        It has to contain one element more than there are tiles.
+     * \param hits bitmask of the tiles, bit i % 64 of element i / 64 is set for tile i.
+     *        It is resized and cleared by this method.
+     */
+    void mark_column(const double x0, const double x1, const std::vector<double>& row_edges,
+            std::vector<uint64_t>& hits);
+
+    /**
+     * Set bits [first, last] of a bitmask.
+     */
+    static void set_bits(std::vector<uint64_t>& bits, const size_t first, const size_t last);
+
+    /**
+     * Check if the AVX2 kernel is used on this CPU.
+     */
+    static bool vectorized();
+};
+
+#endif /* SRC_SEGMENT_BATCH_HPP_ */
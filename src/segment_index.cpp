@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "segment_index.hpp"
+#include <boost/geometry.hpp>
+
+SegmentIndex::SegmentIndex(const bgeometry_t& geometry) :
+    m_tree(),
+    m_envelope(),
+    m_areal(std::holds_alternative<bpolygon_t>(geometry) || std::holds_alternative<bmulti_polygon_t>(geometry)) {
+    std::vector<bsegment_t> segments = collect_segments(geometry);
+    // use the packing algorithm of the range constructor
+    m_tree = rtree_t(segments.begin(), segments.end());
+    bgeom::convert(m_tree.bounds(), m_envelope);
+}
+
+/*static*/ bool SegmentIndex::supports(const bgeometry_t& geometry) {
+    return !std::holds_alternative<bpoint_t>(geometry) && !std::holds_alternative<bmulti_point_t>(geometry);
+}
+
+/*static*/ void SegmentIndex::add_segments(std::vector<bsegment_t>& segments, const blinestring_t& linestring) {
+    for (size_t i = 1; i < linestring.size(); ++i) {
+        segments.emplace_back(linestring[i - 1], linestring[i]);
+    }
+}
+
+template <typename TRing>
+/*static*/ void SegmentIndex::add_ring_segments(std::vector<bsegment_t>& segments, const TRing& ring) {
+    for (size_t i = 1; i < ring.size(); ++i) {
+        segments.emplace_back(ring[i - 1], ring[i]);
+    }
+    // close the ring if it is not closed
+    if (ring.size() > 2 && !bgeom::equals(ring.front(), ring.back())) {
+        segments.emplace_back(ring.back(), ring.front());
+    }
+}
+
+/*static*/ void SegmentIndex::add_polygon_segments(std::vector<bsegment_t>& segments, const bpolygon_t& polygon) {
+    add_ring_segments(segments, polygon.outer());
+    for (const auto& inner : polygon.inners()) {
+        add_ring_segments(segments, inner);
+    }
+}
+
+/*static*/ std::vector<bsegment_t> SegmentIndex::collect_segments(const bgeometry_t& geometry) {
+    std::vector<bsegment_t> segments;
+    segments.reserve(std::visit([](const auto& g) { return static_cast<size_t>(bgeom::num_points(g)); }, geometry));
+    if (std::holds_alternative<blinestring_t>(geometry)) {
+        add_segments(segments, std::get<blinestring_t>(geometry));
+    } else if (std::holds_alternative<bmulti_linestring_t>(geometry)) {
+        for (const auto& ls : std::get<bmulti_linestring_t>(geometry)) {
+            add_segments(segments, ls);
+        }
+    } else if (std::holds_alternative<bpolygon_t>(geometry)) {
+        add_polygon_segments(segments, std::get<bpolygon_t>(geometry));
+    } else if (std::holds_alternative<bmulti_polygon_t>(geometry)) {
+        for (const auto& polygon : std::get<bmulti_polygon_t>(geometry)) {
+            add_polygon_segments(segments, polygon);
+        }
+    }
+    return segments;
+}
+
+bool SegmentIndex::edges_intersect(const box_t& box) const {
+    return m_tree.qbegin(bgeom::index::intersects(box)) != m_tree.qend();
+}
+
+void SegmentIndex::query(const box_t& box, SegmentBatch& batch) const {
+    for (auto it = m_tree.qbegin(bgeom::index::intersects(box)); it != m_tree.qend(); ++it) {
+        batch.add(*it);
+    }
+}
+
+bool SegmentIndex::contains(const bpoint_t& point) const {
+    if (!m_areal || m_tree.empty() || !bgeom::covered_by(point, m_envelope)) {
+        return false;
+    }
+    // Cast a ray from the point to the right and count the crossed edges. Only the
+    // edges whose bounding box touches the ray are retrieved from the index.
+    const double px = point.x();
+    const double py = point.y();
+    box_t ray {{px, py}, {m_envelope.max_corner().x(), py}};
+    bool inside = false;
+    for (auto it = m_tree.qbegin(bgeom::index::intersects(ray)); it != m_tree.qend(); ++it) {
+        const bpoint_t& a = it->first;
+        const bpoint_t& b = it->second;
+        // half-open rule: a vertex on the ray is counted for the edge above it only
+        if ((a.y() > py) != (b.y() > py)) {
+            double x = a.x() + (py - a.y()) * (b.x() - a.x()) / (b.y() - a.y());
+            if (x > px) {
+                inside = !inside;
+            }
+        }
+    }
+    return inside;
+}
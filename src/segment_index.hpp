@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SRC_SEGMENT_INDEX_HPP_
+#define SRC_SEGMENT_INDEX_HPP_
+
+#include <vector>
+#include <boost/geometry/index/rtree.hpp>
+#include "geometry_types.hpp"
+#include "segment_batch.hpp"
+
+/**
+ * R-tree over the edges of a linear or areal geometry.
+ *
+ * Checking a large geometry for intersection with a tile using Boost Geometry
+ * has to look at every edge of the geometry. With this index, only the edges
+ * near the tile are looked at.
+ *
+ * If no edge intersects a tile, the tile is either completely inside or
+ * completely outside an areal geometry. This is decided by a point-in-polygon
+ * test which uses the index as well.
+ */
+class SegmentIndex {
+
+    using rtree_t = bgeom::index::rtree<bsegment_t, bgeom::index::rstar<16>>;
+
+    rtree_t m_tree;
+
+    /// envelope of all edges
+    box_t m_envelope;
+
+    bool m_areal;
+
+    static void add_segments(std::vector<bsegment_t>& segments, const blinestring_t& linestring);
+
+    template <typename TRing>
+    static void add_ring_segments(std::vector<bsegment_t>& segments, const TRing& ring);
+
+    static void add_polygon_segments(std::vector<bsegment_t>& segments, const bpolygon_t& polygon);
+
+    static std::vector<bsegment_t> collect_segments(const bgeometry_t& geometry);
+
+public:
+    /**
+     * Build the index. The geometry has to be linear or areal.
+     */
+    explicit SegmentIndex(const bgeometry_t& geometry);
+
+    /**
+     * Check if the index can be used for a geometry.
+     */
+    static bool supports(const bgeometry_t& geometry);
+
+    bool areal() const noexcept {
+        return m_areal;
+    }
+
+    size_t size() const noexcept {
+        return m_tree.size();
+    }
+
+    /**
+     * Check if any edge intersects with the box (including its boundary).
+     */
+    bool edges_intersect(const box_t& box) const;
+
+    /**
+     * Add all edges whose envelope intersects with the box to a batch.
+     */
+    void query(const box_t& box, SegmentBatch& batch) const;
+
+    /**
+     * Check if a point is inside the areal geometry using the crossing number
+     * algorithm. The result is undefined if the point is located on an edge.
+     */
+    bool contains(const bpoint_t& point) const;
+};
+
+#endif /* SRC_SEGMENT_INDEX_HPP_ */
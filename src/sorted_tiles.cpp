@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "sorted_tiles.hpp"
+
+SortedTiles::SortedTiles(std::vector<uint64_t> tiles, std::vector<interval_t> intervals) {
+    // Merge overlapping and adjacent intervals. Afterwards, every tile is covered by one interval only.
+    std::sort(intervals.begin(), intervals.end());
+    size_t merged = 0;
+    for (size_t i = 0; i < intervals.size(); ++i) {
+        if (intervals[i].first >= intervals[i].second) {
+            continue;
+        }
+        if (merged > 0 && intervals[i].first <= intervals[merged - 1].second) {
+            intervals[merged - 1].second = std::max(intervals[merged - 1].second, intervals[i].second);
+        } else {
+            intervals[merged++] = intervals[i];
+        }
+    }
+    intervals.resize(merged);
+    m_offsets.reserve(intervals.size());
+    for (const interval_t& interval : intervals) {
+        m_offsets.push_back(m_size);
+        m_size += interval.second - interval.first;
+    }
+    // Drop the single tiles inside of an interval.
+    if (!intervals.empty()) {
+        auto interval = intervals.begin();
+        auto out = tiles.begin();
+        for (const uint64_t quadkey : tiles) {
+            while (interval != intervals.end() && interval->second <= quadkey) {
+                ++interval;
+            }
+            if (interval == intervals.end() || quadkey < interval->first) {
+                *out++ = quadkey;
+            }
+        }
+        tiles.erase(out, tiles.end());
+    }
+    m_size += tiles.size();
+    m_tiles = std::move(tiles);
+    m_intervals = std::move(intervals);
+}
+
+uint64_t SortedTiles::interval_tiles_before(const uint64_t quadkey) const {
+    // first interval which does not start before the quadkey
+    const auto it = std::lower_bound(m_intervals.begin(), m_intervals.end(), quadkey,
+            [](const interval_t& i, const uint64_t q) { return i.first < q; });
+    if (it == m_intervals.begin()) {
+        return 0;
+    }
+    const size_t i = static_cast<size_t>(it - m_intervals.begin()) - 1;
+    return m_offsets[i] + std::min(quadkey, m_intervals[i].second) - m_intervals[i].first;
+}
+
+uint64_t SortedTiles::count(const uint64_t first, const uint64_t last) const {
+    if (first >= last) {
+        return 0;
+    }
+    const auto lower = std::lower_bound(m_tiles.begin(), m_tiles.end(), first);
+    const auto upper = std::lower_bound(lower, m_tiles.end(), last);
+    return static_cast<uint64_t>(upper - lower) + interval_tiles_before(last) - interval_tiles_before(first);
+}
+
+uint64_t SortedTiles::predecessor(const uint64_t quadkey, const uint64_t none) const {
+    uint64_t result = none;
+    auto tile = std::lower_bound(m_tiles.begin(), m_tiles.end(), quadkey);
+    if (tile != m_tiles.begin()) {
+        result = *(tile - 1);
+    }
+    auto interval = std::lower_bound(m_intervals.begin(), m_intervals.end(), quadkey,
+            [](const interval_t& i, const uint64_t q) { return i.first < q; });
+    if (interval != m_intervals.begin()) {
+        const uint64_t candidate = std::min(quadkey, (interval - 1)->second) - 1;
+        if (result == none || candidate > result) {
+            result = candidate;
+        }
+    }
+    return result;
+}
+
+std::vector<uint64_t> SortedTiles::split(const uint64_t part_size) const {
+    std::vector<uint64_t> starts;
+    // tiles left until the next part starts
+    uint64_t remaining = 0;
+    auto take_single = [&](const uint64_t quadkey) {
+        if (remaining == 0) {
+            starts.push_back(quadkey);
+            remaining = part_size;
+        }
+        --remaining;
+    };
+    auto tile = m_tiles.begin();
+    for (const interval_t& interval : m_intervals) {
+        for (; tile != m_tiles.end() && *tile < interval.first; ++tile) {
+            take_single(*tile);
+        }
+        uint64_t quadkey = interval.first;
+        while (quadkey < interval.second) {
+            if (remaining == 0) {
+                starts.push_back(quadkey);
+                remaining = part_size;
+            }
+            const uint64_t take = std::min(remaining, interval.second - quadkey);
+            quadkey += take;
+            remaining -= take;
+        }
+    }
+    for (; tile != m_tiles.end(); ++tile) {
+        take_single(*tile);
+    }
+    return starts;
+}
+
+std::vector<uint64_t> SortedTiles::expand() const {
+    std::vector<uint64_t> result;
+    result.reserve(m_size);
+    for_each(0, ~uint64_t{0}, [&result](const uint64_t quadkey) {
+        result.push_back(quadkey);
+    });
+    return result;
+}
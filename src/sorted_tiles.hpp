@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+
+#ifndef SRC_SORTED_TILES_HPP_
+#define SRC_SORTED_TILES_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * Sorted set of quadkeys of tiles at the same zoom level, stored as single quadkeys and intervals
+ * of quadkeys.
+ *
+ * Tiles added as ranges (e.g. bounding boxes) are kept as intervals and only visited one by one
+ * when iterating, so the memory needed does not depend on the number of tiles in them.
+ */
+class SortedTiles {
+
+public:
+    using interval_t = std::pair<uint64_t, uint64_t>;
+
+private:
+    /// sorted single quadkeys, none of them is inside of an interval
+    std::vector<uint64_t> m_tiles;
+
+    /// sorted, disjoint and non-adjacent half-open intervals of quadkeys
+    std::vector<interval_t> m_intervals;
+
+    /// number of tiles in the intervals before each interval
+    std::vector<uint64_t> m_offsets;
+
+    uint64_t m_size = 0;
+
+    /**
+     * Number of tiles of the intervals smaller than a quadkey
+     */
+    uint64_t interval_tiles_before(const uint64_t quadkey) const;
+
+public:
+    SortedTiles() = default;
+
+    /**
+     * \param tiles sorted quadkeys without duplicates
+     * \param intervals half-open intervals of quadkeys in any order, they may overlap
+     */
+    SortedTiles(std::vector<uint64_t> tiles, std::vector<interval_t> intervals);
+
+    /**
+     * Number of tiles in the set
+     */
+    uint64_t size() const noexcept {
+        return m_size;
+    }
+
+    bool empty() const noexcept {
+        return m_size == 0;
+    }
+
+    /**
+     * Number of tiles in the set with a quadkey in [first, last)
+     */
+    uint64_t count(const uint64_t first, const uint64_t last) const;
+
+    /**
+     * Get the largest quadkey in the set which is smaller than a quadkey.
+     *
+     * \param none value to return if there is no such quadkey
+     */
+    uint64_t predecessor(const uint64_t quadkey, const uint64_t none) const;
+
+    /**
+     * Split the set into parts of at most part_size tiles.
+     *
+     * \returns smallest quadkey of each part in ascending order
+     */
+    std::vector<uint64_t> split(const uint64_t part_size) const;
+
+    /**
+     * Get all quadkeys as a vector. This needs memory for every tile of the intervals.
+     */
+    std::vector<uint64_t> expand() const;
+
+    /**
+     * Call a function for every quadkey in [first, last) in ascending order.
+     */
+    template <typename TFunction>
+    void for_each(const uint64_t first, const uint64_t last, TFunction&& func) const {
+        auto tile = std::lower_bound(m_tiles.begin(), m_tiles.end(), first);
+        auto interval = std::upper_bound(m_intervals.begin(), m_intervals.end(), first,
+                [](const uint64_t q, const interval_t& i) { return q < i.second; });
+        while (true) {
+            const uint64_t next_single = (tile != m_tiles.end() && *tile < last) ? *tile : last;
+            const uint64_t next_interval = (interval != m_intervals.end() && interval->first < last)
+                ? std::max(interval->first, first) : last;
+            if (next_single == last && next_interval == last) {
+                return;
+            }
+            if (next_single < next_interval) {
+                func(next_single);
+                ++tile;
+            } else {
+                const uint64_t end = std::min(interval->second, last);
+                for (uint64_t quadkey = next_interval; quadkey < end; ++quadkey) {
+                    func(quadkey);
+                }
+                ++interval;
+            }
+        }
+    }
+};
+
+#endif /* SRC_SORTED_TILES_HPP_ */
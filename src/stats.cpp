@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "stats.hpp"
+#include <sys/resource.h>
+#include <stdexcept>
+
+namespace {
+
+    constexpr std::array<const char*, static_cast<size_t>(Stage::count)> stage_names {
+        "read",
+        "transform",
+        "convert",
+        "cache",
+        "buffer",
+        "envelope",
+        "precheck",
+        "index",
+        "intersects",
+        "classify",
+        "insert",
+        "sort",
+        "check_exists",
+        "format",
+        "write"
+    };
+
+    double to_seconds(const std::chrono::steady_clock::duration d) {
+        return std::chrono::duration<double>(d).count();
+    }
+
+    void write_json_string(FILE* file, const std::string& str) {
+        fputc('"', file);
+        for (const char c : str) {
+            if (c == '"' || c == '\\') {
+                fprintf(file, "\\%c", c);
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                fprintf(file, "\\u%04x", static_cast<unsigned int>(c));
+            } else {
+                fputc(c, file);
+            }
+        }
+        fputc('"', file);
+    }
+
+} // anonymous namespace
+
+Stats::Stats(const bool enabled) :
+    m_enabled(enabled),
+    m_stages(),
+    m_layers(),
+    m_start(std::chrono::steady_clock::now()) {
+}
+
+/*static*/ Stats& Stats::disabled() {
+    // A disabled instance is never modified, therefore it can be shared.
+    static Stats instance {false};
+    return instance;
+}
+
+void Stats::begin_layer(const char* name, const int64_t feature_count) {
+    if (!m_enabled) {
+        return;
+    }
+    m_layers.emplace_back();
+    m_layers.back().name = name;
+    m_layers.back().feature_count = feature_count;
+}
+
+void Stats::end_layer(const std::chrono::steady_clock::duration wall_time) {
+    if (!m_enabled || m_layers.empty()) {
+        return;
+    }
+    m_layers.back().wall_time = wall_time;
+    m_layers.back().peak_rss_kb = peak_rss_kb();
+}
+
+/*static*/ long Stats::peak_rss_kb() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    // ru_maxrss is given in kilobytes on Linux
+    return usage.ru_maxrss;
+}
+
+void Stats::write_json(FILE* file) const {
+    fprintf(file, "{\n  \"wall_time_s\": %.6f,\n",
+            to_seconds(std::chrono::steady_clock::now() - m_start));
+    fprintf(file, "  \"peak_rss_kb\": %ld,\n", peak_rss_kb());
+    fprintf(file, "  \"tiles_tested\": %lu,\n  \"tiles_accepted\": %lu,\n  \"tiles_output\": %lu,\n",
+            m_tiles_tested, m_tiles_accepted, m_tiles_output);
+    fprintf(file, "  \"stages\": {\n");
+    for (size_t i = 0; i < m_stages.size(); ++i) {
+        const StageStats& st = m_stages[i];
+        fprintf(file, "    \"%s\": {\"wall_time_s\": %.6f, \"calls\": %lu, \"vertices\": %lu}%s\n",
+                stage_names[i], to_seconds(st.wall_time), st.calls, st.vertices,
+                (i + 1 < m_stages.size()) ? "," : "");
+    }
+    fprintf(file, "  },\n  \"layers\": [\n");
+    for (size_t i = 0; i < m_layers.size(); ++i) {
+        const LayerStats& l = m_layers[i];
+        fprintf(file, "    {\"name\": ");
+        write_json_string(file, l.name);
+        fprintf(file, ", \"feature_count\": %ld, \"features\": %lu, \"features_skipped\": %lu, \"wall_time_s\": %.6f, " \
+                "\"features_per_s\": %.1f, \"tiles_tested\": %lu, \"tiles_accepted\": %lu, \"peak_rss_kb\": %ld}%s\n",
+                l.feature_count, l.features, l.features_skipped, to_seconds(l.wall_time),
+                to_seconds(l.wall_time) > 0 ? l.features / to_seconds(l.wall_time) : 0.0,
+                l.tiles_tested, l.tiles_accepted, l.peak_rss_kb,
+                (i + 1 < m_layers.size()) ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+void Stats::write_json(const std::string& path) const {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+        throw std::runtime_error{"Failed to open statistics file " + path};
+    }
+    write_json(file);
+    if (fclose(file) != 0) {
+        throw std::runtime_error{"Failed to write statistics file " + path};
+    }
+}
@@ -0,0 +1,234 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SRC_STATS_HPP_
+#define SRC_STATS_HPP_
+
+#include <stdio.h>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Processing stages which are timed separately.
+ */
+enum class Stage : size_t {
+    read = 0,
+    transform,
+    convert,
+    cache,
+    buffer,
+    envelope,
+    precheck,
+    index,
+    intersects,
+    classify,
+    insert,
+    sort,
+    check_exists,
+    format,
+    write,
+    count
+};
+
+/**
+ * Counters collected for a single stage.
+ */
+struct StageStats {
+    std::chrono::steady_clock::duration wall_time {0};
+    uint64_t calls = 0;
+    uint64_t vertices = 0;
+};
+
+/**
+ * Counters collected for a single data layer.
+ */
+struct LayerStats {
+    std::string name;
+    int64_t feature_count = 0;
+    uint64_t features = 0;
+    uint64_t features_skipped = 0;
+    uint64_t tiles_tested = 0;
+    uint64_t tiles_accepted = 0;
+    std::chrono::steady_clock::duration wall_time {0};
+    /// peak resident set size of the process at the end of the layer
+    long peak_rss_kb = 0;
+};
+
+/**
+ * Collects wall time and counters of all processing stages.
+ *
+ * If the instance is disabled, all recording methods return immediately. This keeps
+ * the overhead in the hot loops at a single branch if no report was requested.
+ */
+class Stats {
+
+    bool m_enabled;
+
+    std::array<StageStats, static_cast<size_t>(Stage::count)> m_stages;
+
+    std::vector<LayerStats> m_layers;
+
+    uint64_t m_tiles_tested = 0;
+
+    uint64_t m_tiles_accepted = 0;
+
+    uint64_t m_tiles_output = 0;
+
+    std::chrono::steady_clock::time_point m_start;
+
+    StageStats& stage(const Stage s) {
+        return m_stages[static_cast<size_t>(s)];
+    }
+
+public:
+    explicit Stats(const bool enabled);
+
+    /**
+     * Get a disabled instance for users who are not interested in statistics.
+     */
+    static Stats& disabled();
+
+    bool enabled() const noexcept {
+        return m_enabled;
+    }
+
+    /**
+     * Add the time elapsed since start to the stage and increase its call counter.
+     *
+     * \param calls number of operations performed in the time measured
+     */
+    void record(const Stage s, const std::chrono::steady_clock::time_point start, const uint64_t calls = 1) {
+        StageStats& st = stage(s);
+        st.wall_time += std::chrono::steady_clock::now() - start;
+        st.calls += calls;
+    }
+
+    void add_vertices(const Stage s, const uint64_t count) {
+        if (m_enabled) {
+            stage(s).vertices += count;
+        }
+    }
+
+    void add_tiles_tested(const uint64_t count) {
+        if (m_enabled) {
+            m_tiles_tested += count;
+            if (!m_layers.empty()) {
+                m_layers.back().tiles_tested += count;
+            }
+        }
+    }
+
+    void add_tiles_accepted(const uint64_t count) {
+        if (m_enabled) {
+            m_tiles_accepted += count;
+            if (!m_layers.empty()) {
+                m_layers.back().tiles_accepted += count;
+            }
+        }
+    }
+
+    void add_tiles_output(const uint64_t count) {
+        if (m_enabled) {
+            m_tiles_output += count;
+        }
+    }
+
+    /**
+     * Start a new layer. Subsequent feature and tile counters are attributed to it.
+     */
+    void begin_layer(const char* name, const int64_t feature_count);
+
+    void add_feature() {
+        if (m_enabled && !m_layers.empty()) {
+            ++m_layers.back().features;
+        }
+    }
+
+    /**
+     * Count a feature which was skipped because all of its tiles were known already.
+     */
+    void add_feature_skipped() {
+        if (m_enabled && !m_layers.empty()) {
+            ++m_layers.back().features_skipped;
+        }
+    }
+
+    void end_layer(const std::chrono::steady_clock::duration wall_time);
+
+    /**
+     * Get the peak resident set size of this process in kilobytes.
+     */
+    static long peak_rss_kb();
+
+    /**
+     * Write the report as JSON.
+     */
+    void write_json(FILE* file) const;
+
+    /**
+     * Write the report as JSON into a file.
+     *
+     * \throws std::runtime_error if writing fails
+     */
+    void write_json(const std::string& path) const;
+};
+
+/**
+ * RAII helper measuring the wall time of a stage.
+ *
+ * Reading the clock is expensive compared to checking a single tile. Loops over tiles
+ * therefore use a single timer and report the number of tiles checked with set_calls().
+ */
+class StageTimer {
+
+    Stats& m_stats;
+
+    Stage m_stage;
+
+    uint64_t m_calls = 1;
+
+    std::chrono::steady_clock::time_point m_start;
+
+public:
+    StageTimer(Stats& stats, const Stage stage) :
+        m_stats(stats),
+        m_stage(stage) {
+        if (m_stats.enabled()) {
+            m_start = std::chrono::steady_clock::now();
+        }
+    }
+
+    StageTimer(const StageTimer&) = delete;
+
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    /**
+     * Set the number of operations performed while the timer is running (default: 1).
+     */
+    void set_calls(const uint64_t calls) noexcept {
+        m_calls = calls;
+    }
+
+    ~StageTimer() {
+        if (m_stats.enabled()) {
+            m_stats.record(m_stage, m_start, m_calls);
+        }
+    }
+};
+
+#endif /* SRC_STATS_HPP_ */
@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+
+#include "tile_estimate.hpp"
+#include "output_file.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    /// two-sided 95 % quantile of the normal distribution
+    constexpr double z_95 = 1.96;
+}
+
+TileEstimate::TileEstimate(const uint32_t minzoom, const uint32_t maxzoom) :
+    m_minzoom(minzoom),
+    m_maxzoom(maxzoom) {
+}
+
+void TileEstimate::begin_layer(const std::string& name, const uint64_t feature_count) {
+    m_layers.push_back(Layer{name, feature_count, 0, std::vector<Zoom>(m_maxzoom + 1)});
+}
+
+void TileEstimate::add_sample(std::vector<std::vector<uint64_t>>& tiles, const std::vector<double>& extrapolated) {
+    Layer& layer = m_layers.back();
+    ++layer.sample_size;
+    const double n = static_cast<double>(layer.sample_size);
+    for (uint32_t z = 0; z <= m_maxzoom; ++z) {
+        Zoom& zoom = layer.zooms[z];
+        // Every tile is counted once per feature.
+        std::sort(tiles[z].begin(), tiles[z].end());
+        tiles[z].erase(std::unique(tiles[z].begin(), tiles[z].end()), tiles[z].end());
+        zoom.tiles.insert(zoom.tiles.end(), tiles[z].begin(), tiles[z].end());
+        tiles[z].clear();
+        const double delta = extrapolated[z] - zoom.extrapolated_mean;
+        zoom.extrapolated_mean += delta / n;
+        zoom.extrapolated_m2 += delta * (extrapolated[z] - zoom.extrapolated_mean);
+    }
+}
+
+void TileEstimate::end_layer() {
+    Layer& layer = m_layers.back();
+    if (layer.sample_size == 0) {
+        return;
+    }
+    const double n = static_cast<double>(layer.sample_size);
+    const double N = static_cast<double>(std::max(layer.feature_count, layer.sample_size));
+    // sampling fraction
+    const double q = n / N;
+    for (Zoom& zoom : layer.zooms) {
+        std::sort(zoom.tiles.begin(), zoom.tiles.end());
+        // number of distinct tiles and of tiles found in exactly one and two features of the sample
+        double q1 = 0;
+        double q2 = 0;
+        for (auto it = zoom.tiles.begin(); it != zoom.tiles.end();) {
+            const auto next = std::upper_bound(it, zoom.tiles.end(), *it);
+            const auto features = next - it;
+            ++zoom.observed;
+            if (features == 1) {
+                ++q1;
+            } else if (features == 2) {
+                ++q2;
+            }
+            it = next;
+        }
+        std::vector<uint64_t>{}.swap(zoom.tiles);
+        /* Tiles not found in the sample (Chao and Lin 2012). Without tiles found twice, it is the
+         * number of singletons scaled to the features not sampled. */
+        if (q < 1 && q1 > 0) {
+            const double w = layer.sample_size > 1 ? n / (n - 1) : 1;
+            const double k = q / (1 - q);
+            const double d = 2 * w * q2 + k * q1;
+            const double unseen = q1 * q1 / d;
+            /* Delta method with the frequency counts taken as multinomial with the estimated
+             * total: var = sum of a_i a_j cov(Q_i, Q_j) where a_i is the derivative of the total
+             * with respect to Q_i (1 for tiles found in more than two features). */
+            const double a1 = 1 + (2 * q1 * d - q1 * q1 * k) / (d * d);
+            const double a2 = 1 - 2 * w * q1 * q1 / (d * d);
+            const double rest = zoom.observed - q1 - q2;
+            const double total = zoom.observed + unseen;
+            const double linear = a1 * q1 + a2 * q2 + rest;
+            zoom.unseen = unseen;
+            zoom.variance = std::max(a1 * a1 * q1 + a2 * a2 * q2 + rest - linear * linear / total, 0.0);
+        }
+        zoom.unseen += zoom.extrapolated_mean * N;
+        if (layer.sample_size > 1 && q < 1) {
+            zoom.variance += N * N * (1 - q) * zoom.extrapolated_m2 / (n - 1) / n;
+        }
+    }
+}
+
+TileEstimate::Result TileEstimate::result(const uint32_t zoom) const {
+    double observed = 0;
+    double unseen = 0;
+    double variance = 0;
+    for (const Layer& layer : m_layers) {
+        if (layer.sample_size == 0) {
+            continue;
+        }
+        observed += layer.zooms[zoom].observed;
+        unseen += layer.zooms[zoom].unseen;
+        variance += layer.zooms[zoom].variance;
+    }
+    /* Log-normal interval of the unseen tiles (Chao 1987), the tiles found in the sample are
+     * known to exist. */
+    double factor = 1;
+    if (unseen > 0) {
+        factor = std::exp(z_95 * std::sqrt(std::log(1 + variance / (unseen * unseen))));
+    }
+    const double max_tiles = std::ldexp(1.0, 2 * static_cast<int>(zoom));
+    return Result{std::min(observed + unseen, max_tiles), std::min(observed + unseen / factor, max_tiles),
+        std::min(observed + unseen * factor, max_tiles)};
+}
+
+void TileEstimate::output(OutputFile& output_file) const {
+    for (uint32_t z = m_minzoom; z <= m_maxzoom; ++z) {
+        const Result r = result(z);
+        output_file.print("%u %.0f %.0f %.0f\n", z, r.tiles, r.low, r.high);
+    }
+}
@@ -0,0 +1,135 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+
+
+#ifndef SRC_TILE_ESTIMATE_HPP_
+#define SRC_TILE_ESTIMATE_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class OutputFile;
+
+/**
+ * Estimate of the number of distinct tiles per zoom level computed from a sample of the features
+ * of each layer.
+ *
+ * The tiles of the sampled features are collected per layer and zoom level. The number of distinct
+ * tiles of a layer is estimated from the tiles found in the sample and the number of tiles found
+ * in exactly one and exactly two sampled features, using the incidence-based estimator of Chao for
+ * samples drawn without replacement. If the sampled features do not share tiles, the estimate is
+ * the number of tiles of the sample scaled to the number of features of the layer. The more they
+ * share, the closer it gets to the number of tiles of the sample. A layer sampled completely gives
+ * the exact number of tiles.
+ *
+ * Tiles of features which span too many tiles to be collected are extrapolated per feature and
+ * scaled to the number of features of the layer, tiles shared with other features are counted
+ * multiple times for them. Tiles of multiple layers are counted once per layer.
+ *
+ * The 95 % confidence interval uses the variance of the estimator of the tiles not found in the
+ * sample (Chao's delta method approximation) and of the extrapolated tiles (standard error of the
+ * mean with the finite population correction). It is log-normal, i.e. it does not fall below the
+ * number of tiles found in the sample.
+ */
+class TileEstimate {
+
+public:
+    /**
+     * Estimated number of tiles of a zoom level and its 95 % confidence interval
+     */
+    struct Result {
+        double tiles;
+        double low;
+        double high;
+    };
+
+private:
+    struct Zoom {
+        /// quadkeys of the tiles of each sampled feature, cleared by end_layer()
+        std::vector<uint64_t> tiles;
+        /// running mean and sum of squared deviations of the extrapolated counts (Welford's algorithm)
+        double extrapolated_mean = 0;
+        double extrapolated_m2 = 0;
+        /// number of distinct tiles found in the sample, set by end_layer()
+        double observed = 0;
+        /// estimated number of tiles not found in the sample and extrapolated tiles, set by end_layer()
+        double unseen = 0;
+        /// variance of unseen, set by end_layer()
+        double variance = 0;
+    };
+
+    struct Layer {
+        std::string name;
+        /// number of features of the layer
+        uint64_t feature_count;
+        /// number of features sampled
+        uint64_t sample_size = 0;
+        std::vector<Zoom> zooms;
+    };
+
+    uint32_t m_minzoom;
+
+    uint32_t m_maxzoom;
+
+    std::vector<Layer> m_layers;
+
+public:
+    TileEstimate(const uint32_t minzoom, const uint32_t maxzoom);
+
+    /**
+     * Start a new layer. All following samples belong to it.
+     *
+     * \param feature_count number of features of the layer
+     */
+    void begin_layer(const std::string& name, const uint64_t feature_count);
+
+    /**
+     * Add the tiles of a sampled feature.
+     *
+     * \param tiles quadkeys of the tiles of the feature, indexed by zoom level from 0 to the maximum
+     *        zoom level, a tile may occur multiple times. The vectors are cleared.
+     * \param extrapolated number of tiles per zoom level not contained in tiles
+     */
+    void add_sample(std::vector<std::vector<uint64_t>>& tiles, const std::vector<double>& extrapolated);
+
+    /**
+     * Compute the estimate of the current layer and free the tiles collected for it.
+     */
+    void end_layer();
+
+    uint32_t minzoom() const noexcept {
+        return m_minzoom;
+    }
+
+    uint32_t maxzoom() const noexcept {
+        return m_maxzoom;
+    }
+
+    /**
+     * Get the estimate of a zoom level summed up over all layers. The estimate and its
+     * confidence interval are limited to the number of tiles of the zoom level.
+     */
+    Result result(const uint32_t zoom) const;
+
+    /**
+     * Write one line per zoom level: zoom, estimated number of tiles and the lower and upper
+     * bound of the confidence interval.
+     */
+    void output(OutputFile& output_file) const;
+};
+
+#endif /* SRC_TILE_ESTIMATE_HPP_ */
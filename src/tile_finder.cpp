@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "tile_finder.hpp"
+#include "gdal_intersecting_tiles_finder.hpp"
+
+TileFinder::TileFinder(const uint32_t minzoom, const uint32_t maxzoom, const bool classify) :
+    m_finder(new GDALIntersectingTilesFinder{false, minzoom, maxzoom, false, false, classify}) {
+}
+
+TileFinder::TileFinder(TileFinder&&) noexcept = default;
+
+TileFinder& TileFinder::operator=(TileFinder&&) noexcept = default;
+
+TileFinder::~TileFinder() = default;
+
+void TileFinder::add_wkb(const unsigned char* wkb, const size_t size, const double buffer_size) {
+    m_finder->add_wkb(wkb, size, buffer_size);
+}
+
+void TileFinder::add_lonlat_linestring(const double* coords, const size_t point_count, const double buffer_size) {
+    m_finder->add_lonlat_linestring(coords, point_count, buffer_size);
+}
+
+void TileFinder::add_lonlat_polygon(const double* coords, const size_t point_count, const double buffer_size) {
+    m_finder->add_lonlat_polygon(coords, point_count, buffer_size);
+}
+
+void TileFinder::set_threads(const unsigned threads) {
+    m_finder->set_threads(threads);
+}
+
+uint32_t TileFinder::get_minzoom() const noexcept {
+    return m_finder->get_minzoom();
+}
+
+uint32_t TileFinder::get_maxzoom() const noexcept {
+    return m_finder->tile_list().get_maxzoom();
+}
+
+TileList& TileFinder::tile_list() {
+    return m_finder->tile_list();
+}
+
+std::vector<uint64_t> TileFinder::sorted_quadkeys() {
+    return m_finder->tile_list().sorted_quadkeys();
+}
@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+
+#ifndef SRC_TILE_FINDER_HPP_
+#define SRC_TILE_FINDER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "tile_list.hpp"
+
+class GDALIntersectingTilesFinder;
+
+/**
+ * Public interface of the library to compute the tiles of geometries held in memory.
+ *
+ * It does not depend on the headers of GDAL or Boost Geometry. Geometries are passed as WKB or
+ * as arrays of coordinates in WGS84 (EPSG:4326, longitude before latitude). The tiles are
+ * collected in a TileList which can be read as sorted quadkeys or iterated with
+ * TileList::for_each_tile().
+ */
+class TileFinder {
+
+    std::unique_ptr<GDALIntersectingTilesFinder> m_finder;
+
+public:
+    /**
+     * \param minzoom minimum zoom level
+     * \param maxzoom maximum zoom level, the tile list stores the tiles of this level
+     * \param classify determine if tiles are completely covered by the geometries
+     */
+    TileFinder(const uint32_t minzoom, const uint32_t maxzoom, const bool classify = false);
+
+    TileFinder(const TileFinder&) = delete;
+
+    TileFinder& operator=(const TileFinder&) = delete;
+
+    TileFinder(TileFinder&&) noexcept;
+
+    TileFinder& operator=(TileFinder&&) noexcept;
+
+    ~TileFinder();
+
+    /**
+     * Add all tiles intersecting with a geometry encoded as WKB.
+     *
+     * \param wkb pointer to the WKB
+     * \param size size of the WKB in bytes
+     * \param buffer_size buffer size in meter, 0 to disable buffering
+     *
+     * \throws std::runtime_error if the WKB cannot be parsed or transformed
+     */
+    void add_wkb(const unsigned char* wkb, const size_t size, const double buffer_size = 0);
+
+    /**
+     * Add all tiles intersecting with a linestring.
+     *
+     * \param coords interleaved longitude and latitude of the points (x1, y1, x2, y2, …)
+     * \param point_count number of points
+     * \param buffer_size buffer size in meter, 0 to disable buffering
+     */
+    void add_lonlat_linestring(const double* coords, const size_t point_count, const double buffer_size = 0);
+
+    /**
+     * Add all tiles intersecting with a polygon without holes.
+     *
+     * \param coords interleaved longitude and latitude of the points of the outer ring
+     * \param point_count number of points
+     * \param buffer_size buffer size in meter, 0 to disable buffering
+     */
+    void add_lonlat_polygon(const double* coords, const size_t point_count, const double buffer_size = 0);
+
+    /**
+     * Set the number of threads used to check the tiles of large geometries and to sort the tiles.
+     */
+    void set_threads(const unsigned threads);
+
+    uint32_t get_minzoom() const noexcept;
+
+    uint32_t get_maxzoom() const noexcept;
+
+    /**
+     * Get the tiles found so far.
+     */
+    TileList& tile_list();
+
+    /**
+     * Get the quadkeys of all tiles at the maximum zoom level in ascending order.
+     */
+    std::vector<uint64_t> sorted_quadkeys();
+};
+
+#endif /* SRC_TILE_FINDER_HPP_ */
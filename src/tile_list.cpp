@@ -14,16 +14,23 @@
  */
 
 #include "tile_list.hpp"
+#include "mbtiles_index.hpp"
+#include "output_file.hpp"
+#include "parallel.hpp"
+#include "radix_sort.hpp"
 #include <linux/limits.h>
 #include <unistd.h>
 #include <algorithm>
+#include <cstdarg>
 #include <memory>
 #include <vector>
 
-TileList::TileList(uint32_t maxzoom, bool check_tiles, bool tirex) :
+TileList::TileList(uint32_t maxzoom, bool check_tiles, bool tirex, bool classify, Stats& stats) :
     maxzoom(maxzoom),
     check_tiles(check_tiles), 
-    tirex(tirex) {
+    tirex(tirex),
+    classify(classify),
+    m_stats(stats) {
     last_tile_x = static_cast<uint32_t>(1u << maxzoom) + 1;
     last_tile_y = static_cast<uint32_t>(1u << maxzoom) + 1;
 }
@@ -32,8 +39,8 @@ bool TileList::check_file_exists(const char* path) {
     return (access(path, F_OK) == 0);
 }
 
-std::unique_ptr<char> TileList::get_tile_path(const std::string& path, const uint32_t zoom, const uint32_t x, const uint32_t y, const std::string& suffix, bool tirex_mode) {
-    std::unique_ptr<char> str {new char[PATH_MAX]};
+std::unique_ptr<char[]> TileList::get_tile_path(const std::string& path, const uint32_t zoom, const uint32_t x, const uint32_t y, const std::string& suffix, bool tirex_mode) {
+    std::unique_ptr<char[]> str {new char[PATH_MAX]};
     if (tirex_mode) {
         snprintf(str.get(), PATH_MAX, "x=%u y=%u z=%u %s", 8*x, 8*y, zoom+3, suffix.c_str());
     } else if (path.empty()) {
@@ -44,50 +51,377 @@ std::unique_ptr<char> TileList::get_tile_path(const std::string& path, const uin
     return str;
 }
 
-void TileList::add_tile(uint32_t x, uint32_t y)
+std::unique_ptr<char[]> TileList::get_meta_path(const std::string& path, const uint32_t zoom, const uint32_t x, const uint32_t y) {
+    constexpr uint32_t mask = (1u << metatile_bits) - 1;
+    uint32_t mx = x & ~mask;
+    uint32_t my = y & ~mask;
+    unsigned hash[5];
+    for (int i = 0; i < 5; ++i) {
+        hash[i] = ((mx & 0x0f) << 4) | (my & 0x0f);
+        mx >>= 4;
+        my >>= 4;
+    }
+    std::unique_ptr<char[]> str {new char[PATH_MAX]};
+    if (path.empty()) {
+        snprintf(str.get(), PATH_MAX, "%u/%u/%u/%u/%u/%u.meta", zoom, hash[4], hash[3], hash[2], hash[1], hash[0]);
+    } else {
+        snprintf(str.get(), PATH_MAX, "%s/%u/%u/%u/%u/%u/%u.meta", path.c_str(), zoom, hash[4], hash[3], hash[2],
+                hash[1], hash[0]);
+    }
+    return str;
+}
+
+void TileList::add_tile(uint32_t x, uint32_t y, bool full)
 {
     // Only try to insert to tile into the set if the last inserted tile
     // is different from this tile.
     if (last_tile_x != x || last_tile_y != y) {
-        m_dirty_tiles.insert(xy_to_quadkey(x, y, maxzoom));
+        const uint64_t quadkey = xy_to_quadkey(x, y, maxzoom);
+        if (m_dirty_tiles.insert(quadkey).second && m_track_added) {
+            m_added_tiles.push_back(quadkey);
+        }
         last_tile_x = x;
         last_tile_y = y;
     }
+    if (full && classify) {
+        const uint64_t quadkey = xy_to_quadkey(x, y, maxzoom);
+        if (m_full_tiles.insert(quadkey).second && m_track_added) {
+            m_added_full_tiles.push_back(quadkey);
+        }
+    }
+}
+
+void TileList::add_quadkeys(const std::vector<uint64_t>& quadkeys, const bool full) {
+    if (full && !classify) {
+        return;
+    }
+    std::unordered_set<uint64_t>& tiles = full ? m_full_tiles : m_dirty_tiles;
+    tiles.reserve(tiles.size() + quadkeys.size());
+    tiles.insert(quadkeys.begin(), quadkeys.end());
+}
+
+void TileList::take_added_tiles(std::vector<uint64_t>& tiles, std::vector<uint64_t>& full_tiles) {
+    tiles.clear();
+    full_tiles.clear();
+    tiles.swap(m_added_tiles);
+    full_tiles.swap(m_added_full_tiles);
+}
+
+std::vector<uint64_t> TileList::single_quadkeys(const bool full) const {
+    const std::unordered_set<uint64_t>& tiles = full ? m_full_tiles : m_dirty_tiles;
+    return std::vector<uint64_t>(tiles.begin(), tiles.end());
+}
+
+void TileList::add_range(const ZoomRange& range, const bool open_west, const bool open_east) {
+    const uint32_t max_index = (1u << maxzoom) - 1;
+    ZoomRange clipped {std::min(range.xmin, max_index), std::min(range.xmax, max_index),
+        std::min(range.ymin, max_index), std::min(range.ymax, max_index)};
+    if (clipped.xmin > clipped.xmax || clipped.ymin > clipped.ymax) {
+        return;
+    }
+    add_intervals(m_ranges, clipped, 0, 0, 0);
+    // all but the tiles at the edges of the range are completely covered
+    const uint32_t inner_xmin = open_west ? clipped.xmin : clipped.xmin + 1;
+    const uint32_t inner_xend = open_east ? clipped.xmax + 1 : clipped.xmax;
+    if (classify && inner_xmin < inner_xend && clipped.height() >= 2) {
+        ZoomRange inner {inner_xmin, inner_xend - 1, clipped.ymin + 1, clipped.ymax - 1};
+        add_intervals(m_full_ranges, inner, 0, 0, 0);
+    }
+}
+
+void TileList::add_subtree(const uint32_t zoom, const uint32_t x, const uint32_t y, const bool full) {
+    const uint32_t dz = maxzoom - zoom;
+    const uint64_t quadkey = xy_to_quadkey(x, y, zoom);
+    m_ranges.emplace_back(quadkey << (2 * dz), (quadkey + 1) << (2 * dz));
+    if (classify && full) {
+        m_full_ranges.emplace_back(quadkey << (2 * dz), (quadkey + 1) << (2 * dz));
+    }
+}
+
+void TileList::add_intervals(std::vector<std::pair<uint64_t, uint64_t>>& intervals, const ZoomRange& range,
+        const uint32_t zoom, const uint32_t x, const uint32_t y) const {
+    // tiles at the maximum zoom level covered by the quadtree node
+    const uint32_t dz = maxzoom - zoom;
+    const uint32_t xmin = x << dz;
+    const uint32_t xmax = ((x + 1) << dz) - 1;
+    const uint32_t ymin = y << dz;
+    const uint32_t ymax = ((y + 1) << dz) - 1;
+    if (xmax < range.xmin || xmin > range.xmax || ymax < range.ymin || ymin > range.ymax) {
+        return;
+    }
+    if (xmin >= range.xmin && xmax <= range.xmax && ymin >= range.ymin && ymax <= range.ymax) {
+        const uint64_t quadkey = xy_to_quadkey(x, y, zoom);
+        if (!intervals.empty() && intervals.back().second == quadkey << (2 * dz)) {
+            intervals.back().second = (quadkey + 1) << (2 * dz);
+        } else {
+            intervals.emplace_back(quadkey << (2 * dz), (quadkey + 1) << (2 * dz));
+        }
+        return;
+    }
+    // children in ascending order of their quadkeys (the lowest bit is the x bit)
+    add_intervals(intervals, range, zoom + 1, 2 * x, 2 * y);
+    add_intervals(intervals, range, zoom + 1, 2 * x + 1, 2 * y);
+    add_intervals(intervals, range, zoom + 1, 2 * x, 2 * y + 1);
+    add_intervals(intervals, range, zoom + 1, 2 * x + 1, 2 * y + 1);
+}
+
+const SortedTiles& TileList::merged_ranges(const bool full) {
+    const std::vector<std::pair<uint64_t, uint64_t>>& ranges = full ? m_full_ranges : m_ranges;
+    SortedTiles& merged = full ? m_merged_full_ranges : m_merged_ranges;
+    size_t& count = full ? m_merged_full_ranges_count : m_merged_ranges_count;
+    if (count != ranges.size()) {
+        merged = SortedTiles{{}, ranges};
+        count = ranges.size();
+    }
+    return merged;
+}
+
+bool TileList::contains_range(const ZoomRange& range, const bool full, const bool check_single_tiles) {
+    const std::unordered_set<uint64_t>& tiles = full ? m_full_tiles : m_dirty_tiles;
+    const SortedTiles& ranges = merged_ranges(full);
+    if (ranges.empty() && (tiles.empty() || !check_single_tiles)) {
+        return false;
+    }
+    std::vector<std::pair<uint64_t, uint64_t>> intervals;
+    add_intervals(intervals, range, 0, 0, 0);
+    for (const auto& interval : intervals) {
+        const uint64_t size = interval.second - interval.first;
+        const uint64_t in_ranges = ranges.count(interval.first, interval.second);
+        if (in_ranges == size) {
+            continue;
+        }
+        if (!check_single_tiles || size - in_ranges > tiles.size()) {
+            return false;
+        }
+        for (uint64_t quadkey = interval.first; quadkey < interval.second; ++quadkey) {
+            if (tiles.find(quadkey) == tiles.end() && ranges.count(quadkey, quadkey + 1) == 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void TileList::clear() {
+    m_dirty_tiles.clear();
+    m_full_tiles.clear();
+    m_ranges.clear();
+    m_full_ranges.clear();
+    m_merged_ranges = SortedTiles{};
+    m_merged_full_ranges = SortedTiles{};
+    m_merged_ranges_count = 0;
+    m_merged_full_ranges_count = 0;
+    m_added_tiles.clear();
+    m_added_full_tiles.clear();
+    last_tile_x = static_cast<uint32_t>(1u << maxzoom) + 1;
+    last_tile_y = static_cast<uint32_t>(1u << maxzoom) + 1;
+}
+
+SortedTiles TileList::sorted_tiles() {
+    // build a sorted set of all expired tiles
+    StageTimer timer {m_stats, Stage::sort};
+    return sort_and_merge(std::vector<uint64_t>(m_dirty_tiles.begin(), m_dirty_tiles.end()), m_ranges);
+}
+
+std::vector<uint64_t> TileList::sorted_quadkeys() {
+    return sorted_tiles().expand();
+}
+
+SortedTiles TileList::sorted_full_tiles() const {
+    return sort_and_merge(std::vector<uint64_t>(m_full_tiles.begin(), m_full_tiles.end()), m_full_ranges);
+}
+
+SortedTiles TileList::sort_and_merge(std::vector<uint64_t> tiles,
+        std::vector<std::pair<uint64_t, uint64_t>> intervals) const {
+    radix_sort_unique(tiles, 2 * maxzoom, m_threads);
+    return SortedTiles{std::move(tiles), std::move(intervals)};
+}
+
+bool TileList::is_full(const SortedTiles& sorted_full, const uint32_t zoom, const uint64_t quadkey) const {
+    // The descendants of a tile at the maximum zoom level form a contiguous range of quadkeys.
+    const uint32_t dz = maxzoom - zoom;
+    const uint64_t first = quadkey << (2 * dz);
+    const uint64_t last = (quadkey + 1) << (2 * dz);
+    return sorted_full.count(first, last) == (1ULL << (2 * dz));
+}
+
+namespace {
+
+    /**
+     * Collects the formatted lines of a partition of the output in memory.
+     */
+    class OutputBuffer {
+
+        std::string m_data;
+
+    public:
+        void print(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+            char line[PATH_MAX + 32];
+            va_list args;
+            va_start(args, format);
+            const int length = vsnprintf(line, sizeof(line), format, args);
+            va_end(args);
+            if (length > 0) {
+                m_data.append(line, std::min(static_cast<size_t>(length), sizeof(line) - 1));
+            }
+        }
+
+        const std::string& data() const noexcept {
+            return m_data;
+        }
+
+        void clear() noexcept {
+            m_data.clear();
+        }
+    };
+
+} // anonymous namespace
+
+template <typename TWriter>
+uint64_t TileList::format_tiles(const SortedTiles& tiles, const uint64_t first, const uint64_t last,
+        const uint64_t last_quadkey, const uint32_t minzoom, const SortedTiles& sorted_full, MBTilesIndex::Cursor* cursor,
+        const std::string& suffix, const char delimiter, const std::string& path, Stats& stats,
+        TWriter& writer) const {
+    uint64_t count = 0;
+    /* The tiles of a metatile are visited one after another on each zoom level. Therefore, it is
+     * sufficient to remember the last metatile of each zoom level and whether its file exists
+     * (-1 if not checked yet). The part before this one visited the ancestors of last_quadkey last,
+     * their metatiles have been handled by it. */
+    const bool metatiles = m_metatiles != Metatiles::none;
+    std::vector<uint64_t> last_meta;
+    std::vector<int> last_meta_exists;
+    if (metatiles) {
+        last_meta.assign(maxzoom + 1, ~uint64_t{0});
+        last_meta_exists.assign(maxzoom + 1, -1);
+        if (last_quadkey < (1ULL << (2 * maxzoom))) {
+            for (uint32_t z = minzoom; z <= maxzoom; ++z) {
+                last_meta[z] = (last_quadkey >> (2 * (maxzoom - z))) >> (2 * std::min(z, metatile_bits));
+            }
+        }
+    }
+    for_each_tile(tiles, first, last, last_quadkey, minzoom, [&](const uint32_t zoom, const uint64_t quadkey) {
+        if (metatiles) {
+            // metatiles of zoom levels below metatile_bits have less than 8×8 tiles
+            const uint32_t shift = std::min(zoom, metatile_bits);
+            const uint64_t meta = quadkey >> (2 * shift);
+            const bool first_visit = meta != last_meta[zoom];
+            if (first_visit) {
+                last_meta[zoom] = meta;
+                last_meta_exists[zoom] = -1;
+            } else if (m_metatiles == Metatiles::files) {
+                return;
+            }
+            const bool check_meta = check_tiles && last_meta_exists[zoom] == -1;
+            std::unique_ptr<char[]> meta_path;
+            if (check_meta || m_metatiles == Metatiles::files) {
+                StageTimer timer {stats, Stage::format};
+                xy_coord_t xy = quadkey_to_xy(quadkey, zoom);
+                meta_path = get_meta_path(path, zoom, xy.x, xy.y);
+            }
+            if (check_meta) {
+                StageTimer timer {stats, Stage::check_exists};
+                last_meta_exists[zoom] = check_file_exists(meta_path.get()) ? 1 : 0;
+            }
+            if (last_meta_exists[zoom] == 0) {
+                return;
+            }
+            if (m_metatiles == Metatiles::files) {
+                StageTimer timer {stats, Stage::write};
+                if (classify) {
+                    // A metatile is a tile metatile_bits levels above its tiles.
+                    writer.print("%s %s%c", meta_path.get(),
+                            is_full(sorted_full, zoom - shift, meta) ? "full" : "boundary", delimiter);
+                } else {
+                    writer.print("%s%c", meta_path.get(), delimiter);
+                }
+                ++count;
+                return;
+            }
+        }
+        if (cursor) {
+            /* Tiles are visited in ascending order on each zoom level, the cursor reads every
+             * column of a block of the MBTiles index once. */
+            StageTimer timer {stats, Stage::check_exists};
+            if (!cursor->contains(zoom, quadkey)) {
+                return;
+            }
+        }
+        std::unique_ptr<char[]> tile_path;
+        {
+            StageTimer timer {stats, Stage::format};
+            xy_coord_t xy = quadkey_to_xy(quadkey, zoom);
+            tile_path = get_tile_path(path, zoom, xy.x, xy.y, suffix, tirex);
+        }
+        if (check_tiles && !cursor && !metatiles) {
+            StageTimer timer {stats, Stage::check_exists};
+            if (!check_file_exists(tile_path.get())) {
+                return;
+            }
+        }
+        StageTimer timer {stats, Stage::write};
+        if (classify) {
+            writer.print("%s %s%c", tile_path.get(),
+                    is_full(sorted_full, zoom, quadkey) ? "full" : "boundary", delimiter);
+        } else {
+            writer.print("%s%c", tile_path.get(), delimiter);
+        }
+        ++count;
+    });
+    return count;
 }
 
-void TileList::output(FILE* output_file, uint32_t minzoom, const std::string& suffix,
+void TileList::output(OutputFile& output_file, uint32_t minzoom, const std::string& suffix,
         const char delimiter, const std::string& path) {
-    // build a sorted vector of all expired tiles
-    std::vector<uint64_t> tiles_maxzoom(m_dirty_tiles.begin(),
-                                        m_dirty_tiles.end());
-    std::sort(tiles_maxzoom.begin(), tiles_maxzoom.end());
-    /* Loop over all requested zoom levels (from maximum down to the minimum zoom level).
-     * Tile IDs of the tiles enclosing this tile at lower zoom levels are calculated using
-     * bit shifts.
-     *
-     * last_quadkey is initialized with a value which is not expected to exist
-     * (larger than largest possible quadkey). */
-    uint64_t last_quadkey = 1ULL << (2 * maxzoom);
-    for (std::vector<uint64_t>::const_iterator it = tiles_maxzoom.cbegin();
-         it != tiles_maxzoom.cend(); ++it) {
-        for (uint32_t dz = 0; dz <= maxzoom - minzoom; dz++) {
-            // scale down to the current zoom level
-            uint64_t qt_current = *it >> (dz * 2);
-            /* If dz > 0, there are propably multiple elements whose quadkey
-             * is equal because they are all sub-tiles of the same tile at the current
-             * zoom level. We skip all of them after we have written the first sibling.
-             */
-            if (qt_current == last_quadkey >> (dz * 2)) {
-                continue;
+    SortedTiles sorted_full;
+    if (classify) {
+        sorted_full = sorted_full_tiles();
+    }
+    const bool use_mbtiles = check_tiles && m_mbtiles && m_metatiles == Metatiles::none;
+    const SortedTiles tiles = sorted_tiles();
+    // larger than the largest possible quadkey
+    const uint64_t no_quadkey = 1ULL << (2 * maxzoom);
+    if (m_threads <= 1 || tiles.size() <= output_partition_size) {
+        std::unique_ptr<MBTilesIndex::Cursor> cursor;
+        if (use_mbtiles) {
+            cursor.reset(new MBTilesIndex::Cursor{*m_mbtiles});
+        }
+        m_stats.add_tiles_output(format_tiles(tiles, 0, no_quadkey, no_quadkey, minzoom, sorted_full,
+                cursor.get(), suffix, delimiter, path, m_stats, output_file));
+    } else {
+        /* Split the sorted tiles into partitions which are formatted in parallel. A partition
+         * visits the parent tiles not visited by the partitions before it because it starts
+         * with the last quadkey of the previous partition. The buffers are written in order
+         * after each wave of partitions to limit the memory usage. Partitions are ranges of
+         * quadkeys, the intervals of the tiles are not expanded. */
+        const std::vector<uint64_t> starts = tiles.split(output_partition_size);
+        const size_t partition_count = starts.size();
+        const size_t wave_size = static_cast<size_t>(m_threads) * 4;
+        std::vector<OutputBuffer> buffers(wave_size);
+        std::vector<uint64_t> counts(wave_size);
+        for (size_t first = 0; first < partition_count; first += wave_size) {
+            const size_t count = std::min(wave_size, partition_count - first);
+            {
+                StageTimer timer {m_stats, Stage::format};
+                // Stats are not thread-safe, workers report to a disabled instance.
+                parallel_for(count, m_threads, [&](const size_t i) {
+                    const size_t part = first + i;
+                    const uint64_t begin = starts[part];
+                    const uint64_t end = part + 1 < partition_count ? starts[part + 1] : no_quadkey;
+                    std::unique_ptr<MBTilesIndex::Cursor> cursor;
+                    if (use_mbtiles) {
+                        cursor.reset(new MBTilesIndex::Cursor{*m_mbtiles});
+                    }
+                    buffers[i].clear();
+                    counts[i] = format_tiles(tiles, begin, end, tiles.predecessor(begin, no_quadkey),
+                            minzoom, sorted_full, cursor.get(), suffix, delimiter, path, Stats::disabled(), buffers[i]);
+                });
             }
-            xy_coord_t xy = quadkey_to_xy(qt_current, maxzoom - dz);
-            std::unique_ptr<char> tile_path = get_tile_path(path, maxzoom - dz, xy.x, xy.y, suffix, tirex);
-            if (check_tiles && !check_file_exists(tile_path.get())) {
-                continue;
+            StageTimer timer {m_stats, Stage::write};
+            for (size_t i = 0; i < count; ++i) {
+                output_file.write(buffers[i].data().data(), buffers[i].data().size());
+                m_stats.add_tiles_output(counts[i]);
             }
-            fprintf(output_file, "%s%c", tile_path.get(), delimiter);
         }
-        last_quadkey = *it;
     }
 }
 
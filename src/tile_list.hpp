@@ -17,10 +17,19 @@
 #define SRC_TILE_LIST_HPP_
 
 #include <stdio.h>
+#include <algorithm>
 #include <cstdint>
 #include <memory>
 #include <string>
 #include <unordered_set>
+#include <utility>
+#include <vector>
+#include "mbtiles_index.hpp"
+#include "sorted_tiles.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+
+class OutputFile;
 
 /**
  * Simple struct for the x and y index of a tile ID.
@@ -34,6 +43,25 @@ struct xy_coord_t
 
 class TileList {
 
+public:
+    /**
+     * Handling of metatiles, i.e. blocks of 8×8 tiles stored in one file by mod_tile
+     */
+    enum class Metatiles {
+        /// print tiles and check the existence of every tile
+        none,
+        /// print the paths of the metatile files once per metatile
+        files,
+        /// print tiles but check the existence of their metatile files
+        tiles
+    };
+
+    /**
+     * Number of zoom levels between a metatile and its tiles, a metatile has 2^3 × 2^3 tiles.
+     */
+    static constexpr uint32_t metatile_bits = 3;
+
+private:
     uint32_t maxzoom;
 
     /**
@@ -46,6 +74,31 @@ class TileList {
      */
     bool tirex;
 
+    /**
+     * Classify tiles as fully covered or boundary tiles in the output.
+     */
+    bool classify;
+
+    /**
+     * instrumentation of insertion and output
+     */
+    Stats& m_stats;
+
+    /**
+     * number of threads used to format the output
+     */
+    unsigned m_threads = 1;
+
+    /**
+     * metatile mode of the output
+     */
+    Metatiles m_metatiles = Metatiles::none;
+
+    /**
+     * MBTiles file to check tile existence against instead of a directory, not owned
+     */
+    MBTilesIndex* m_mbtiles = nullptr;
+
     /**
      * x coordinate of the tile which has been added as last tile to the unordered set
      */
@@ -77,6 +130,105 @@ class TileList {
      */
     std::unordered_set<uint64_t> m_dirty_tiles;
 
+    /**
+     * Quadkeys of the tiles at the maximum zoom level which are completely covered by
+     * at least one geometry. It is a subset of m_dirty_tiles and only filled if
+     * classification is enabled.
+     */
+    std::unordered_set<uint64_t> m_full_tiles;
+
+    /**
+     * Record the quadkeys of single tiles when they are inserted into m_dirty_tiles or m_full_tiles
+     */
+    bool m_track_added = false;
+
+    /**
+     * Quadkeys of the single tiles inserted since the last call of take_added_tiles() (unsorted)
+     */
+    std::vector<uint64_t> m_added_tiles;
+
+    /**
+     * Quadkeys of the completely covered tiles inserted since the last call of take_added_tiles() (unsorted)
+     */
+    std::vector<uint64_t> m_added_full_tiles;
+
+    /**
+     * Tiles added as ranges, e.g. bounding boxes. Each range is stored as half-open intervals
+     * of quadkeys at the maximum zoom level which are aligned to the quadtree. The intervals
+     * of different ranges may overlap, they are merged when the tiles are sorted.
+     */
+    std::vector<std::pair<uint64_t, uint64_t>> m_ranges;
+
+    /**
+     * Completely covered tiles added as ranges, same format as m_ranges
+     */
+    std::vector<std::pair<uint64_t, uint64_t>> m_full_ranges;
+
+    /**
+     * m_ranges and m_full_ranges merged for contains_range(), rebuilt if ranges have been
+     * added since (see merged_ranges())
+     */
+    SortedTiles m_merged_ranges;
+    SortedTiles m_merged_full_ranges;
+
+    /**
+     * number of intervals of m_ranges and m_full_ranges when m_merged_ranges and
+     * m_merged_full_ranges were built
+     */
+    size_t m_merged_ranges_count = 0;
+    size_t m_merged_full_ranges_count = 0;
+
+    /**
+     * Split a range of tiles at the maximum zoom level into the quadkey intervals of the
+     * largest quadtree nodes completely inside of it and append them to intervals. The
+     * intervals are appended in ascending order.
+     *
+     * \param range tile range at the maximum zoom level
+     * \param zoom zoom level of the current quadtree node
+     * \param x x index of the current quadtree node
+     * \param y y index of the current quadtree node
+     */
+    void add_intervals(std::vector<std::pair<uint64_t, uint64_t>>& intervals, const ZoomRange& range,
+            const uint32_t zoom, const uint32_t x, const uint32_t y) const;
+
+    /**
+     * Get the ranges merged, rebuild them if ranges have been added since the last call.
+     *
+     * \param full get the completely covered ranges
+     */
+    const SortedTiles& merged_ranges(const bool full);
+
+    /**
+     * Sort quadkeys of single tiles and merge them with intervals of tiles.
+     */
+    SortedTiles sort_and_merge(std::vector<uint64_t> tiles, std::vector<std::pair<uint64_t, uint64_t>> intervals) const;
+
+    /**
+     * Number of tiles at the maximum zoom level in a partition of the output
+     */
+    static constexpr size_t output_partition_size = 1 << 14;
+
+    /**
+     * Format the tiles of a part of the sorted tiles and their parents (see
+     * for_each_tile()), check if they exist and pass the lines to writer.print().
+     *
+     * \param tiles result of sorted_tiles()
+     * \param first smallest quadkey of the part
+     * \param last end of the part (exclusive)
+     * \param last_quadkey largest tile before the part or a value larger than all quadkeys
+     * \param sorted_full result of sorted_full_tiles(), only used if tiles are classified
+     * \param cursor cursor on m_mbtiles, nullptr to check existence in the file system
+     * \returns number of lines written
+     */
+    template <typename TWriter>
+    uint64_t format_tiles(const SortedTiles& tiles, const uint64_t first, const uint64_t last,
+            const uint64_t last_quadkey, const uint32_t minzoom, const SortedTiles& sorted_full, MBTilesIndex::Cursor* cursor,
+            const std::string& suffix, const char delimiter, const std::string& path, Stats& stats,
+            TWriter& writer) const;
+
+public:
+    TileList(uint32_t maxzoom, bool check_tiles, bool tirex, bool classify, Stats& stats);
+
     /**
      * Helper method to convert a tile ID (x and y) into a quadkey
      * using bitshifts.
@@ -100,23 +252,266 @@ class TileList {
      */
     static xy_coord_t quadkey_to_xy(uint64_t quadkey, uint32_t zoom);
 
-public:
-    TileList(uint32_t maxzoom, bool check_tiles, bool tirex);
-
     static bool check_file_exists(const char* path);
 
-    static std::unique_ptr<char> get_tile_path(const std::string& path, const uint32_t zoom, const uint32_t x, const uint32_t y, const std::string& suffix, bool tirex);
+    /**
+     * Check tile existence against an MBTiles file instead of the file system.
+     * The index has to outlive the tile list.
+     */
+    void set_mbtiles(MBTilesIndex* mbtiles) noexcept {
+        m_mbtiles = mbtiles;
+    }
+
+    /**
+     * Set the number of threads used by output() and to sort the tiles.
+     */
+    void set_threads(const unsigned threads) noexcept {
+        m_threads = std::max(threads, 1u);
+    }
+
+    static std::unique_ptr<char[]> get_tile_path(const std::string& path, const uint32_t zoom, const uint32_t x, const uint32_t y, const std::string& suffix, bool tirex);
+
+    /**
+     * Get the path of the metatile file containing a tile in the hashed directory layout of
+     * mod_tile: zoom/h4/h3/h2/h1/h0.meta where each hash byte combines four bits of x and y
+     * of the first tile of the metatile.
+     *
+     * \param path tile directory, may be empty
+     * \param zoom zoom level
+     * \param x x index of any tile of the metatile
+     * \param y y index of any tile of the metatile
+     */
+    static std::unique_ptr<char[]> get_meta_path(const std::string& path, const uint32_t zoom, const uint32_t x, const uint32_t y);
+
+    /**
+     * Set how metatiles are handled by output(). Existence checks in metatile modes are done
+     * against metatile files, not an MBTiles file.
+     */
+    void set_metatiles(const Metatiles metatiles) noexcept {
+        m_metatiles = metatiles;
+    }
 
     /**
      * Add a single tile to the list
      *
      * \param x x index of the tile to be expired.
      * \param y y index of the tile to be expired.
-     * \param suffix file suffix to add
+     * \param full tile is completely covered by the geometry
+     */
+    void add_tile(uint32_t x, uint32_t y, bool full = false);
+
+    /**
+     * Add all tiles of a range at the maximum zoom level to the list, e.g. the tiles of a
+     * bounding box. The range is stored as a few quadkey intervals instead of single tiles.
+     *
+     * If tiles are classified, the tiles at the edges of the range are boundary tiles and
+     * all other tiles are completely covered.
+     *
+     * \param range tile range at the maximum zoom level, it is clipped to the valid tiles
+     * \param open_west the area continues west of the range across the antimeridian, the tiles of
+     *        its western edge are not boundary tiles
+     * \param open_east the area continues east of the range across the antimeridian
+     */
+    void add_range(const ZoomRange& range, const bool open_west = false, const bool open_east = false);
+
+    /**
+     * Add all descendants at the maximum zoom level of a tile at a lower zoom level to the list.
+     * They are stored as a single quadkey interval like the tiles of add_range().
+     *
+     * \param zoom zoom level of the tile, at most the maximum zoom level
+     * \param x x index of the tile
+     * \param y y index of the tile
+     * \param full the tile is completely covered, ignored if tiles are not classified
+     */
+    void add_subtree(const uint32_t zoom, const uint32_t x, const uint32_t y, const bool full);
+
+    /**
+     * Add single tiles at the maximum zoom level by their quadkeys, e.g. tiles saved by a previous
+     * run. They are not recorded as added tiles.
+     *
+     * \param quadkeys quadkeys of the tiles
+     * \param full tiles are completely covered, ignored if tiles are not classified
+     */
+    void add_quadkeys(const std::vector<uint64_t>& quadkeys, const bool full);
+
+    /**
+     * Start or stop recording the single tiles inserted into the list, see take_added_tiles().
+     */
+    void track_added_tiles(const bool track) noexcept {
+        m_track_added = track;
+    }
+
+    /**
+     * Move the quadkeys of the single tiles inserted since the last call into two vectors,
+     * the previous content of the vectors is discarded. Tiles inserted once are reported once.
+     *
+     * \param tiles unsorted quadkeys of all inserted tiles
+     * \param full_tiles unsorted quadkeys of the inserted completely covered tiles
+     */
+    void take_added_tiles(std::vector<uint64_t>& tiles, std::vector<uint64_t>& full_tiles);
+
+    /**
+     * Get the quadkeys of all single tiles (not the ranges) in no particular order.
+     *
+     * \param full get the completely covered tiles only
+     */
+    std::vector<uint64_t> single_quadkeys(const bool full) const;
+
+    /**
+     * Check if all tiles of a range at the maximum zoom level are in the list.
+     *
+     * The range is split into quadtree-aligned intervals of quadkeys which are looked up in the
+     * merged ranges (tiles added using add_range() or add_subtree()). Single tiles are looked up
+     * one by one, this can be disabled for large ranges.
+     *
+     * \param range tile range at the maximum zoom level
+     * \param full require the tiles to be completely covered
+     * \param check_single_tiles look up the tiles not covered by ranges in the single tiles
+     */
+    bool contains_range(const ZoomRange& range, const bool full, const bool check_single_tiles = true);
+
+    uint32_t get_maxzoom() const noexcept {
+        return maxzoom;
+    }
+
+    /**
+     * Number of single tiles at the maximum zoom level, tiles added using add_range() are not counted
      */
-    void add_tile(uint32_t x, uint32_t y);
+    size_t size() const noexcept {
+        return m_dirty_tiles.size();
+    }
 
-    void output(FILE* output_file, uint32_t minzoom, const std::string& suffix, const char delimiter, const std::string& path);
+    /**
+     * Remove all tiles from the list.
+     */
+    void clear();
+
+    /**
+     * Get all tiles at the maximum zoom level sorted by their quadkeys. Tiles added as ranges
+     * are kept as intervals.
+     */
+    SortedTiles sorted_tiles();
+
+    /**
+     * Get the quadkeys of all tiles at the maximum zoom level in ascending order.
+     *
+     * Unlike sorted_tiles() and for_each_tile(), this needs memory for every tile of the ranges.
+     */
+    std::vector<uint64_t> sorted_quadkeys();
+
+    /**
+     * Get all completely covered tiles at the maximum zoom level sorted by their quadkeys.
+     */
+    SortedTiles sorted_full_tiles() const;
+
+    /**
+     * Check if a tile is completely covered, i.e. all of its descendants at the maximum
+     * zoom level are completely covered.
+     *
+     * \param sorted_full result of sorted_full_tiles()
+     * \param zoom zoom level of the tile
+     * \param quadkey quadkey of the tile
+     */
+    bool is_full(const SortedTiles& sorted_full, const uint32_t zoom, const uint64_t quadkey) const;
+
+    /**
+     * Call a function for every tile in the list and for all of their parent tiles
+     * down to the minimum zoom level. Every tile is visited once.
+     *
+     * Tiles are visited ordered by the quadkey of their descendants at the maximum
+     * zoom level. A parent tile is visited directly after its first child.
+     *
+     * \param minzoom minimum zoom level
+     * \param func function to be called with the zoom level and the quadkey of the tile
+     */
+    template <typename TFunction>
+    void for_each_tile(const uint32_t minzoom, TFunction&& func) {
+        const SortedTiles tiles_maxzoom = sorted_tiles();
+        /* last_quadkey is initialized with a value which is not expected to exist
+         * (larger than largest possible quadkey). */
+        const uint64_t no_quadkey = 1ULL << (2 * maxzoom);
+        for_each_tile(tiles_maxzoom, 0, no_quadkey, no_quadkey, minzoom, std::forward<TFunction>(func));
+    }
+
+    /**
+     * Call a function for the tiles of a part of sorted tiles and for all of their parent
+     * tiles which have not been visited in the part before it.
+     *
+     * This is the counterpart of the overload for vectors of quadkeys which does not expand
+     * the intervals of the sorted tiles.
+     *
+     * \param tiles result of sorted_tiles()
+     * \param first smallest quadkey of the part
+     * \param last end of the part (exclusive)
+     * \param last_quadkey largest tile before the part or a value larger than all quadkeys
+     *        if the part starts at the beginning
+     * \param minzoom minimum zoom level
+     * \param func function to be called with the zoom level and the quadkey of the tile
+     */
+    template <typename TFunction>
+    void for_each_tile(const SortedTiles& tiles, const uint64_t first, const uint64_t last,
+            uint64_t last_quadkey, const uint32_t minzoom, TFunction&& func) const {
+        tiles.for_each(first, last, [&](const uint64_t quadkey) {
+            visit_tile(quadkey, last_quadkey, minzoom, func);
+            last_quadkey = quadkey;
+        });
+    }
+
+    /**
+     * Call a function for the tiles of a part of a sorted vector of quadkeys and for all
+     * of their parent tiles which have not been visited in the part before it.
+     *
+     * Visiting consecutive parts of the result of sorted_quadkeys() visits the same tiles
+     * in the same order as for_each_tile(minzoom, func) if last_quadkey is the element
+     * preceding each part. Therefore, the parts can be visited independently.
+     *
+     * \param begin first quadkey of the part
+     * \param end end of the part
+     * \param last_quadkey quadkey preceding the part or a value larger than all quadkeys
+     *        if the part starts at the beginning of the vector
+     * \param minzoom minimum zoom level
+     * \param func function to be called with the zoom level and the quadkey of the tile
+     */
+    template <typename TFunction>
+    void for_each_tile(const uint64_t* begin, const uint64_t* end, uint64_t last_quadkey,
+            const uint32_t minzoom, TFunction&& func) const {
+        /* Loop over all requested zoom levels (from maximum down to the minimum zoom level).
+         * Tile IDs of the tiles enclosing this tile at lower zoom levels are calculated using
+         * bit shifts. */
+        for (const uint64_t* it = begin; it != end; ++it) {
+            visit_tile(*it, last_quadkey, minzoom, func);
+            last_quadkey = *it;
+        }
+    }
+
+    /**
+     * Call a function for a tile at the maximum zoom level and for its parent tiles which
+     * are not parents of the tile visited before it.
+     */
+    template <typename TFunction>
+    void visit_tile(const uint64_t quadkey, const uint64_t last_quadkey, const uint32_t minzoom,
+            TFunction& func) const {
+        for (uint32_t dz = 0; dz <= maxzoom - minzoom; dz++) {
+            // scale down to the current zoom level
+            uint64_t qt_current = quadkey >> (dz * 2);
+            /* If dz > 0, there are propably multiple elements whose quadkey
+             * is equal because they are all sub-tiles of the same tile at the current
+             * zoom level. We skip all of them after we have visited the first sibling.
+             */
+            if (qt_current == last_quadkey >> (dz * 2)) {
+                continue;
+            }
+            func(maxzoom - dz, qt_current);
+        }
+    }
+
+    /**
+     * Write all tiles and their parent tiles down to the minimum zoom level.
+     *
+     * If more than one thread is set, the sorted tiles are split into partitions which are
+     * formatted (and checked for existence) in parallel. The output is the same.
+     */
+    void output(OutputFile& output_file, uint32_t minzoom, const std::string& suffix, const char delimiter, const std::string& path);
 };
 
 
@@ -0,0 +1,201 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "tile_space_index.hpp"
+#include "projection.hpp"
+#include "segment_batch.hpp"
+#include <algorithm>
+#include <cmath>
+#include <boost/geometry.hpp>
+
+namespace {
+
+    /* Products of coordinate differences need up to 64 bits plus sign, therefore
+     * 128 bit integers (a GCC/Clang extension) are used for exact calculations. */
+    __extension__ typedef __int128 wide_t;
+
+    wide_t floor_div(const wide_t n, const wide_t d) {
+        wide_t q = n / d;
+        if (n % d != 0 && n < 0) {
+            --q;
+        }
+        return q;
+    }
+
+    wide_t ceil_div(const wide_t n, const wide_t d) {
+        wide_t q = n / d;
+        if (n % d != 0 && n > 0) {
+            ++q;
+        }
+        return q;
+    }
+
+} // anonymous namespace
+
+TileSpaceIndex::TileSpaceIndex(const bgeometry_t& geometry, const uint32_t maxzoom) :
+    m_tree(),
+    m_maxzoom(maxzoom),
+    m_shift(world_bits - maxzoom),
+    m_areal(std::holds_alternative<bpolygon_t>(geometry) || std::holds_alternative<bmulti_polygon_t>(geometry)),
+    m_max_x(0) {
+    std::vector<segment_t> segments;
+    segments.reserve(std::visit([](const auto& g) { return static_cast<size_t>(bgeom::num_points(g)); }, geometry));
+    if (std::holds_alternative<blinestring_t>(geometry)) {
+        add_linestring(segments, std::get<blinestring_t>(geometry));
+    } else if (std::holds_alternative<bmulti_linestring_t>(geometry)) {
+        for (const auto& ls : std::get<bmulti_linestring_t>(geometry)) {
+            add_linestring(segments, ls);
+        }
+    } else if (std::holds_alternative<bpolygon_t>(geometry)) {
+        add_polygon(segments, std::get<bpolygon_t>(geometry));
+    } else if (std::holds_alternative<bmulti_polygon_t>(geometry)) {
+        for (const auto& polygon : std::get<bmulti_polygon_t>(geometry)) {
+            add_polygon(segments, polygon);
+        }
+    }
+    for (const segment_t& s : segments) {
+        m_max_x = std::max({m_max_x, bgeom::get<0, 0>(s), bgeom::get<1, 0>(s)});
+    }
+    // use the packing algorithm of the range constructor
+    m_tree = rtree_t(segments.begin(), segments.end());
+}
+
+/*static*/ bool TileSpaceIndex::supports(const bgeometry_t& geometry, const uint32_t maxzoom) {
+    return maxzoom < world_bits && !std::holds_alternative<bpoint_t>(geometry)
+        && !std::holds_alternative<bmulti_point_t>(geometry);
+}
+
+TileSpaceIndex::coordinate_t TileSpaceIndex::to_tile_x(const double merc_x) const {
+    const double world = static_cast<double>(1 << world_bits);
+    /* about one world of margin on each side for geometries extending beyond the map, e.g. buffers,
+     * and one unit of headroom for the query boxes */
+    const double value = std::round((merc_x / projection::earth_circumfence + 0.5) * world);
+    return static_cast<coordinate_t>(std::min(std::max(value, -world), 2 * world - 2));
+}
+
+TileSpaceIndex::coordinate_t TileSpaceIndex::to_tile_y(const double merc_y) const {
+    const double world = static_cast<double>(1 << world_bits);
+    const double value = std::round((0.5 - merc_y / projection::earth_circumfence) * world);
+    return static_cast<coordinate_t>(std::min(std::max(value, -world), 2 * world - 2));
+}
+
+TileSpaceIndex::point_t TileSpaceIndex::to_tile_space(const bpoint_t& point) const {
+    return point_t{to_tile_x(point.x()), to_tile_y(point.y())};
+}
+
+void TileSpaceIndex::add_linestring(std::vector<segment_t>& segments, const blinestring_t& linestring) const {
+    for (size_t i = 1; i < linestring.size(); ++i) {
+        segments.emplace_back(to_tile_space(linestring[i - 1]), to_tile_space(linestring[i]));
+    }
+}
+
+template <typename TRing>
+void TileSpaceIndex::add_ring(std::vector<segment_t>& segments, const TRing& ring) const {
+    for (size_t i = 1; i < ring.size(); ++i) {
+        segments.emplace_back(to_tile_space(ring[i - 1]), to_tile_space(ring[i]));
+    }
+    // close the ring if it is not closed
+    if (ring.size() > 2 && !bgeom::equals(ring.front(), ring.back())) {
+        segments.emplace_back(to_tile_space(ring.back()), to_tile_space(ring.front()));
+    }
+}
+
+void TileSpaceIndex::add_polygon(std::vector<segment_t>& segments, const bpolygon_t& polygon) const {
+    add_ring(segments, polygon.outer());
+    for (const auto& inner : polygon.inners()) {
+        add_ring(segments, inner);
+    }
+}
+
+void TileSpaceIndex::mark_column(const uint32_t x, const uint32_t ymin, const uint32_t count,
+        std::vector<uint64_t>& hits) const {
+    hits.assign((static_cast<size_t>(count) + 63) / 64, 0);
+    if (count == 0) {
+        return;
+    }
+    const int64_t size = tile_size();
+    const int64_t x0 = static_cast<int64_t>(x) << m_shift;
+    const int64_t x1 = x0 + size;
+    const int64_t first_row = ymin;
+    const int64_t last_row = static_cast<int64_t>(ymin) + count - 1;
+    // The query box is one unit larger, the edges found are checked exactly below.
+    const box_t column {{static_cast<coordinate_t>(x0 - 1), static_cast<coordinate_t>((first_row << m_shift) - 1)},
+        {static_cast<coordinate_t>(x1 + 1), static_cast<coordinate_t>(((last_row + 1) << m_shift) + 1)}};
+    for (auto it = m_tree.qbegin(bgeom::index::intersects(column)); it != m_tree.qend(); ++it) {
+        int64_t ax = bgeom::get<0, 0>(*it);
+        int64_t ay = bgeom::get<0, 1>(*it);
+        int64_t bx = bgeom::get<1, 0>(*it);
+        int64_t by = bgeom::get<1, 1>(*it);
+        if (ax > bx) {
+            std::swap(ax, bx);
+            std::swap(ay, by);
+        }
+        // clip the edge to the column
+        const int64_t c0 = std::max(ax, x0);
+        const int64_t c1 = std::min(bx, x1);
+        if (c0 > c1) {
+            continue;
+        }
+        /* y of the clipped edge is ylo / dx to yhi / dx. A tile row r spans from r * size to
+         * (r + 1) * size including its boundary. */
+        wide_t ylo;
+        wide_t yhi;
+        wide_t dx = bx - ax;
+        if (dx == 0) {
+            dx = 1;
+            ylo = std::min(ay, by);
+            yhi = std::max(ay, by);
+        } else {
+            const wide_t y0 = static_cast<wide_t>(ay) * dx + static_cast<wide_t>(c0 - ax) * (by - ay);
+            const wide_t y1 = static_cast<wide_t>(ay) * dx + static_cast<wide_t>(c1 - ax) * (by - ay);
+            ylo = std::min(y0, y1);
+            yhi = std::max(y0, y1);
+        }
+        const wide_t row_lo = std::max<wide_t>(ceil_div(ylo, dx * size) - 1, first_row);
+        const wide_t row_hi = std::min<wide_t>(floor_div(yhi, dx * size), last_row);
+        if (row_lo <= row_hi) {
+            SegmentBatch::set_bits(hits, static_cast<size_t>(row_lo - first_row), static_cast<size_t>(row_hi - first_row));
+        }
+    }
+}
+
+bool TileSpaceIndex::contains_tile_center(const uint32_t x, const uint32_t y) const {
+    const int64_t half = tile_size() / 2;
+    const int64_t px = (static_cast<int64_t>(x) << m_shift) + half;
+    const int64_t py = (static_cast<int64_t>(y) << m_shift) + half;
+    if (!m_areal || m_tree.empty() || px > m_max_x) {
+        return false;
+    }
+    // Cast a ray from the point to the right and count the crossed edges.
+    const box_t ray {{static_cast<coordinate_t>(px - 1), static_cast<coordinate_t>(py - 1)},
+        {static_cast<coordinate_t>(m_max_x + 1), static_cast<coordinate_t>(py + 1)}};
+    bool inside = false;
+    for (auto it = m_tree.qbegin(bgeom::index::intersects(ray)); it != m_tree.qend(); ++it) {
+        const int64_t ax = bgeom::get<0, 0>(*it);
+        const int64_t ay = bgeom::get<0, 1>(*it);
+        const int64_t bx = bgeom::get<1, 0>(*it);
+        const int64_t by = bgeom::get<1, 1>(*it);
+        // half-open rule: a vertex on the ray is only counted for the edges on one side of the ray
+        if ((ay > py) != (by > py)) {
+            // The crossing is right of the point if (ax - px) + (py - ay) * (bx - ax) / (by - ay) > 0.
+            const wide_t dy = by - ay;
+            const wide_t numerator = static_cast<wide_t>(ax - px) * dy + static_cast<wide_t>(py - ay) * (bx - ax);
+            if ((dy > 0) ? (numerator > 0) : (numerator < 0)) {
+                inside = !inside;
+            }
+        }
+    }
+    return inside;
+}
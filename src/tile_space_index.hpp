@@ -0,0 +1,123 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Copyright (C) 2024 Geofabrik GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SRC_TILE_SPACE_INDEX_HPP_
+#define SRC_TILE_SPACE_INDEX_HPP_
+
+#include <cstdint>
+#include <vector>
+#include <boost/geometry/geometries/point.hpp>
+#include <boost/geometry/index/rtree.hpp>
+#include "geometry_types.hpp"
+
+/**
+ * R-tree over the edges of a linear or areal geometry in fixed-point tile coordinates.
+ *
+ * This is an alternative to SegmentIndex. The vertices are converted once from Web Mercator
+ * into 32 bit integers: the tile index at the maximum zoom level shifted by a number of
+ * sub-tile bits. The edges of tiles are multiples of tile_size() then, and intersection and
+ * point-in-polygon tests are exact integer calculations. An edge needs half of the memory
+ * of an edge with double coordinates.
+ *
+ * Vertices are rounded to 1/tile_size() of a tile. The world spans 2^30 units, i.e. there
+ * are 30 - maxzoom sub-tile bits.
+ */
+class TileSpaceIndex {
+
+public:
+    using coordinate_t = int32_t;
+    using point_t = bgeom::model::point<coordinate_t, 2, bgeom::cs::cartesian>;
+    using segment_t = bgeom::model::segment<point_t>;
+    using box_t = bgeom::model::box<point_t>;
+
+    /// number of bits of the coordinates of the world
+    static constexpr uint32_t world_bits = 30;
+
+private:
+    using rtree_t = bgeom::index::rtree<segment_t, bgeom::index::rstar<16>>;
+
+    rtree_t m_tree;
+
+    uint32_t m_maxzoom;
+
+    /// number of sub-tile bits
+    uint32_t m_shift;
+
+    bool m_areal;
+
+    /// maximum x coordinate of all edges
+    coordinate_t m_max_x;
+
+    coordinate_t to_tile_x(const double merc_x) const;
+
+    coordinate_t to_tile_y(const double merc_y) const;
+
+    point_t to_tile_space(const bpoint_t& point) const;
+
+    void add_linestring(std::vector<segment_t>& segments, const blinestring_t& linestring) const;
+
+    template <typename TRing>
+    void add_ring(std::vector<segment_t>& segments, const TRing& ring) const;
+
+    void add_polygon(std::vector<segment_t>& segments, const bpolygon_t& polygon) const;
+
+public:
+    /**
+     * Build the index. The geometry (in Web Mercator) has to be linear or areal.
+     *
+     * \param maxzoom maximum zoom level, it has to be smaller than world_bits
+     */
+    TileSpaceIndex(const bgeometry_t& geometry, const uint32_t maxzoom);
+
+    /**
+     * Check if the index can be used for a geometry and zoom level.
+     */
+    static bool supports(const bgeometry_t& geometry, const uint32_t maxzoom);
+
+    bool areal() const noexcept {
+        return m_areal;
+    }
+
+    size_t size() const noexcept {
+        return m_tree.size();
+    }
+
+    /**
+     * Number of units of a tile at the maximum zoom level
+     */
+    coordinate_t tile_size() const noexcept {
+        return coordinate_t{1} << m_shift;
+    }
+
+    /**
+     * Mark all tiles of a part of a column which are intersected by an edge (including touching
+     * their boundary).
+     *
+     * \param x x index of the column
+     * \param ymin y index of the first tile
+     * \param count number of tiles
+     * \param hits bitmask of the tiles, bit i % 64 of element i / 64 is set for tile ymin + i.
+     *        It is resized and cleared by this method.
+     */
+    void mark_column(const uint32_t x, const uint32_t ymin, const uint32_t count, std::vector<uint64_t>& hits) const;
+
+    /**
+     * Check if the center of a tile is inside the areal geometry using the crossing number
+     * algorithm. The result is undefined if the center is located on an edge.
+     */
+    bool contains_tile_center(const uint32_t x, const uint32_t y) const;
+};
+
+#endif /* SRC_TILE_SPACE_INDEX_HPP_ */
@@ -17,6 +17,7 @@
 #include <string.h>
 #include <algorithm>
 #include <array>
+#include <fstream>
 #include <iostream>
 
 
@@ -39,6 +40,32 @@
     return BoundingBox{coords[0], coords[1], coords[2], coords[3]};
 }
 
+/*static*/ std::vector<BoundingBox> BoundingBox::from_file(const std::string& path) {
+    std::ifstream file {path};
+    if (!file) {
+        throw std::runtime_error{"Failed to open bounding box file " + path};
+    }
+    std::vector<BoundingBox> bboxes;
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(file, line)) {
+        ++line_number;
+        const size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+        try {
+            bboxes.push_back(from_str(line.c_str() + start));
+        } catch (std::runtime_error& e) {
+            throw std::runtime_error{path + " line " + std::to_string(line_number) + ": " + e.what()};
+        }
+    }
+    if (file.bad()) {
+        throw std::runtime_error{"Failed to read bounding box file " + path};
+    }
+    return bboxes;
+}
+
 BoundingBox::BoundingBox(double x1, double y1, double x2, double y2) :
     min_lon(x1),
     min_lat(y1),
@@ -46,6 +73,13 @@ BoundingBox::BoundingBox(double x1, double y1, double x2, double y2) :
     max_lat(y2) {
 }
 
+std::vector<BoundingBox> BoundingBox::split_at_antimeridian() const {
+    if (min_lon <= max_lon) {
+        return {*this};
+    }
+    return {BoundingBox{-180, min_lat, max_lon, max_lat}, BoundingBox{min_lon, min_lat, 180, max_lat}};
+}
+
 BoundingBox::BoundingBox() :
     BoundingBox(-180, -83, 180, 83) {
 }
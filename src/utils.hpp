@@ -8,6 +8,8 @@
 #ifndef SRC_UTILS_HPP_
 #define SRC_UTILS_HPP_
 
+#include <string>
+#include <vector>
 #include "projection.hpp"
 
 struct BoundingBox {
@@ -18,8 +20,22 @@ struct BoundingBox {
 
     static BoundingBox from_str(const char* bbox_str);
 
+    /**
+     * Read bounding boxes from a file, one per line in the format accepted by from_str().
+     * Empty lines and lines starting with # are skipped.
+     *
+     * \throws std::runtime_error if the file cannot be read or a line is invalid
+     */
+    static std::vector<BoundingBox> from_file(const std::string& path);
+
     BoundingBox(double x1, double y1, double x2, double y2);
 
+    /**
+     * Split a bounding box crossing the antimeridian (min_lon > max_lon) into the parts
+     * -180 … max_lon and min_lon … 180, in this order. Other bounding boxes are returned unchanged.
+     */
+    std::vector<BoundingBox> split_at_antimeridian() const;
+
     BoundingBox();
 };
 